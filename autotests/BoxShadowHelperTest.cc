@@ -0,0 +1,665 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "BoxShadowHelper.h"
+#include "BoxShadowHelper_p.h"
+#include "CompositeShadowParams.h"
+#include "ScratchArena.h"
+#include "ShadowReference.h"
+
+// Qt
+#include <QTest>
+
+// std
+#include <random>
+
+using namespace Material;
+using namespace Material::BoxShadowHelper;
+
+namespace
+{
+
+void fillRandom(QImage &image)
+{
+    std::mt19937 generator(image.width() * 7919 + image.height());
+    std::uniform_int_distribution<int> distribution(0, 255);
+
+    for (int y = 0; y < image.height(); ++y) {
+        uchar *line = image.scanLine(y);
+        for (int x = 0; x < image.width(); ++x) {
+            line[x] = distribution(generator);
+        }
+    }
+}
+
+// Blurs a line with every box of the cascade in turn. Each box divides with
+// a plain integer division and sees zeros outside of the line, which is
+// what the fused kernels are supposed to compute.
+void referenceBoxBlurLine(uchar *data, int size, int stride, const QVector<int> &boxSizes)
+{
+    QVector<int> sums(size + 1);
+    for (const int boxSize : boxSizes) {
+        const int radius = boxSizeToRadius(boxSize);
+
+        sums[0] = 0;
+        for (int i = 0; i < size; ++i) {
+            sums[i + 1] = sums[i] + data[i * stride];
+        }
+
+        for (int i = 0; i < size; ++i) {
+            const int window = sums[qMin(size, i + radius + 1)] - sums[qMax(0, i - radius)];
+            data[i * stride] = window / boxSize;
+        }
+    }
+}
+
+// Blurs all rows, and then all columns.
+QImage referenceBoxBlur(const QImage &image, int radius)
+{
+    const QVector<int> boxSizes = computeBoxSizes(radius, MAX_BLUR_ITERATIONS);
+
+    QImage blurred = image.copy();
+    for (int y = 0; y < blurred.height(); ++y) {
+        referenceBoxBlurLine(blurred.scanLine(y), blurred.width(), 1, boxSizes);
+    }
+    for (int x = 0; x < blurred.width(); ++x) {
+        referenceBoxBlurLine(blurred.bits() + x, blurred.height(), blurred.bytesPerLine(), boxSizes);
+    }
+
+    return blurred;
+}
+
+// The box as boxShadowAlpha() rasterizes it, before it is blurred.
+QImage rasterizedBox(const QSize &boxSize, int radius, qreal dpr)
+{
+    const QSize size = boxSize + 2 * QSize(radius, radius);
+
+    QImage image(size * dpr, QImage::Format_Alpha8);
+    image.fill(0);
+
+    const QRect boxRect = QRect(QPoint(radius, radius) * dpr, boxSize * dpr) & image.rect();
+    for (int y = boxRect.top(); y <= boxRect.bottom(); ++y) {
+        std::fill_n(image.scanLine(y) + boxRect.left(), boxRect.width(), 255);
+    }
+
+    return image;
+}
+
+int maxDifference(const QImage &a, const QImage &b)
+{
+    int difference = 0;
+    for (int y = 0; y < a.height(); ++y) {
+        const uchar *lineA = a.constScanLine(y);
+        const uchar *lineB = b.constScanLine(y);
+        for (int x = 0; x < a.width(); ++x) {
+            difference = qMax(difference, qAbs(lineA[x] - lineB[x]));
+        }
+    }
+    return difference;
+}
+
+QVector<BoxBlurKernel> boxBlurKernels()
+{
+    QVector<BoxBlurKernel> kernels;
+    kernels.append({ 1, boxBlurSteps });
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.append({ 4, boxBlurStepsSse2 });
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.append({ 8, boxBlurStepsAvx2 });
+    }
+#endif
+    return kernels;
+}
+
+QVector<BoxBlurColumnsStepFunc> boxBlurColumnsSteps()
+{
+    QVector<BoxBlurColumnsStepFunc> steps;
+    steps.append(boxBlurColumnsStep);
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        steps.append(boxBlurColumnsStepSse2);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        steps.append(boxBlurColumnsStepAvx2);
+    }
+#endif
+    return steps;
+}
+
+QVector<TintRowFunc> tintRowKernels(bool over)
+{
+    QVector<TintRowFunc> kernels;
+    kernels.append(over ? tintRowOver : tintRow);
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        kernels.append(over ? tintRowOverSse2 : tintRowSse2);
+    }
+    if (__builtin_cpu_supports("avx2")) {
+        kernels.append(over ? tintRowOverAvx2 : tintRowAvx2);
+    }
+#endif
+    return kernels;
+}
+
+} // anonymous namespace
+
+class BoxShadowHelperTest : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void testReciprocal();
+
+    void testBoxBlurSteps_data();
+    void testBoxBlurSteps();
+
+    void testBoxBlurColumnsStep_data();
+    void testBoxBlurColumnsStep();
+
+    void testBoxBlur_data();
+    void testBoxBlur();
+
+    void testDirectRows_data();
+    void testDirectRows();
+
+    void testSeparable_data();
+    void testSeparable();
+
+    void testDownsampledBoxBlur_data();
+    void testDownsampledBoxBlur();
+
+    void testRecursiveGaussian_data();
+    void testRecursiveGaussian();
+
+    void testMultithreadedBlur_data();
+    void testMultithreadedBlur();
+
+    void testTintRow_data();
+    void testTintRow();
+
+    void testCompositeShadowAlpha_data();
+    void testCompositeShadowAlpha();
+};
+
+void BoxShadowHelperTest::testReciprocal()
+{
+    // A window of a box holds at most 255 per pixel. The quotient with the
+    // reciprocal never decreases as the window grows, so it is enough to
+    // check the first and the last window of every exact quotient.
+    for (int boxSize = 1; boxSize <= MAX_RECIPROCAL_BOX_SIZE; ++boxSize) {
+        const quint64 reciprocal = boxSizeToReciprocal(boxSize);
+        for (int quotient = 0; quotient <= 255; ++quotient) {
+            const quint64 first = quint64(quotient) * boxSize;
+            const quint64 last = first + boxSize - 1;
+            if ((first * reciprocal) >> RECIPROCAL_SHIFT != quint64(quotient)
+                    || (last * reciprocal) >> RECIPROCAL_SHIFT != quint64(quotient)) {
+                QFAIL(qPrintable(QStringLiteral("Wrong quotient for the box size %1").arg(boxSize)));
+            }
+        }
+    }
+}
+
+void BoxShadowHelperTest::testBoxBlurSteps_data()
+{
+    QTest::addColumn<QVector<int>>("boxSizes");
+    QTest::addColumn<int>("width");
+
+    const QVector<QVector<int>> cascades = {
+        { 3 },
+        { 3, 3, 5 },
+        { 7, 7, 7 },
+        { 21, 21, 23 },
+        { 129, 131, 131 },
+    };
+
+    for (int i = 0; i < cascades.count(); ++i) {
+        for (const int width : { 1, 5, 64, 200 }) {
+            QTest::addRow("cascade %d, width %d", i, width) << cascades.at(i) << width;
+        }
+    }
+}
+
+void BoxShadowHelperTest::testBoxBlurSteps()
+{
+    QFETCH(QVector<int>, boxSizes);
+    QFETCH(int, width);
+
+    // Enough rows for one group of the widest kernel.
+    const int rowCount = 8;
+
+    QImage image(width, rowCount, QImage::Format_Alpha8);
+    fillRandom(image);
+
+    QImage reference = image.copy();
+    for (int y = 0; y < rowCount; ++y) {
+        referenceBoxBlurLine(reference.scanLine(y), width, 1, boxSizes);
+    }
+
+    // The kernels store one column of the result at a time, one byte per
+    // row, so the expected output is transposed.
+    QByteArray expected(width * rowCount, 0);
+    for (int y = 0; y < rowCount; ++y) {
+        for (int x = 0; x < width; ++x) {
+            expected[x * rowCount + y] = reference.constScanLine(y)[x];
+        }
+    }
+
+    const BoxBlurCascade cascade = makeBoxBlurCascade(image, boxSizes);
+    const int latency = cascadeLatency(cascade);
+    const int stepCount = width + latency;
+
+    for (const BoxBlurKernel &kernel : boxBlurKernels()) {
+        ScratchArena arena;
+        QByteArray output(width * rowCount, 0);
+        uchar *data = reinterpret_cast<uchar *>(output.data());
+
+        for (int y = 0; y < rowCount; y += kernel.lanes) {
+            BoxBlurState state(cascade, kernel.lanes, arena);
+
+            // The sweep is interrupted halfway, like the tiles of the
+            // horizontal pass do.
+            const int split = stepCount / 2;
+            kernel.steps(cascade, y, state, 0, split, data + y, rowCount);
+            kernel.steps(cascade, y, state, split, stepCount,
+                         data + qMax(0, split - latency) * rowCount + y, rowCount);
+        }
+
+        QCOMPARE(output, expected);
+    }
+}
+
+void BoxShadowHelperTest::testBoxBlurColumnsStep_data()
+{
+    QTest::addColumn<int>("boxSize");
+    QTest::addColumn<int>("count");
+
+    for (const int boxSize : { 1, 3, 7, 31, 255 }) {
+        for (const int count : { 1, 3, 4, 5, 8, 13, 64, 100 }) {
+            QTest::addRow("box %d, %d columns", boxSize, count) << boxSize << count;
+        }
+    }
+}
+
+void BoxShadowHelperTest::testBoxBlurColumnsStep()
+{
+    QFETCH(int, boxSize);
+    QFETCH(int, count);
+
+    // Enough rows to fill the window and then slide it.
+    const int height = 3 * boxSize + 5;
+
+    QImage image(count, height, QImage::Format_Alpha8);
+    fillRandom(image);
+
+    // A step outputs the average of the last boxSize rows it was fed.
+    QByteArray expected(count * height, 0);
+    for (int y = 0; y < height; ++y) {
+        for (int x = 0; x < count; ++x) {
+            int window = 0;
+            for (int i = qMax(0, y - boxSize + 1); i <= y; ++i) {
+                window += image.constScanLine(i)[x];
+            }
+            expected[y * count + x] = window / boxSize;
+        }
+    }
+
+    const quint32 reciprocal = boxSizeToReciprocal(boxSize);
+
+    for (const BoxBlurColumnsStepFunc step : boxBlurColumnsSteps()) {
+        QByteArray ring(boxSize * count, 0);
+        QVector<qint32> windows(count, 0);
+        QByteArray output(count * height, 0);
+
+        int position = 0;
+        for (int y = 0; y < height; ++y) {
+            step(image.constScanLine(y),
+                 reinterpret_cast<uchar *>(ring.data()) + position * count,
+                 windows.data(),
+                 reinterpret_cast<uchar *>(output.data()) + y * count,
+                 count, reciprocal);
+            if (++position == boxSize) {
+                position = 0;
+            }
+        }
+
+        QCOMPARE(output, expected);
+    }
+}
+
+void BoxShadowHelperTest::testBoxBlur_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const QSize &boxSize : { QSize(1, 1), QSize(17, 9), QSize(129, 129) }) {
+        for (const int radius : { 1, 2, 3, 4, 6, 9, 10, 16, 25, 40, 63 }) {
+            for (const qreal dpr : { 1.0, 1.5, 2.0 }) {
+                // Larger radii are blurred at a reduced resolution.
+                if (qRound(radius * dpr) >= 64) {
+                    continue;
+                }
+                QTest::addRow("%dx%d, radius %d, dpr %g", boxSize.width(), boxSize.height(), radius, dpr)
+                    << boxSize << radius << dpr;
+            }
+        }
+    }
+
+    // Large enough to be split into bands.
+    QTest::newRow("300x300, radius 20, dpr 1") << QSize(300, 300) << 20 << 1.0;
+}
+
+void BoxShadowHelperTest::testBoxBlur()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const QImage shadow = boxShadowAlpha(boxSize, radius, dpr, Algorithm::BoxBlur);
+    const QImage reference = referenceBoxBlur(rasterizedBox(boxSize, radius, dpr), qRound(radius * dpr));
+
+    QCOMPARE(shadow.size(), reference.size());
+    QCOMPARE(maxDifference(shadow, reference), 0);
+}
+
+void BoxShadowHelperTest::testDirectRows_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+
+    for (const QSize &boxSize : { QSize(1, 1), QSize(17, 9), QSize(129, 70) }) {
+        for (const int radius : { 4, 10, 25, 63 }) {
+            QTest::addRow("%dx%d, radius %d", boxSize.width(), boxSize.height(), radius)
+                << boxSize << radius;
+        }
+    }
+}
+
+void BoxShadowHelperTest::testDirectRows()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+
+    setTiledTransposeEnabled(false);
+    const QImage direct = boxShadowAlpha(boxSize, radius, 1.0, Algorithm::BoxBlur);
+    setTiledTransposeEnabled(true);
+    const QImage tiled = boxShadowAlpha(boxSize, radius, 1.0, Algorithm::BoxBlur);
+
+    QCOMPARE(direct.size(), tiled.size());
+    QCOMPARE(maxDifference(direct, tiled), 0);
+}
+
+void BoxShadowHelperTest::testSeparable_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    // Small boxes are narrower than the blur, so the profiles of their two
+    // edges overlap.
+    for (const QSize &boxSize : { QSize(1, 1), QSize(3, 5), QSize(17, 9), QSize(129, 129) }) {
+        for (const int radius : { 1, 2, 4, 9, 16, 25, 64, 100 }) {
+            for (const qreal dpr : { 1.0, 1.25, 1.5, 2.0, 3.0 }) {
+                QTest::addRow("%dx%d, radius %d, dpr %g", boxSize.width(), boxSize.height(), radius, dpr)
+                    << boxSize << radius << dpr;
+            }
+        }
+    }
+}
+
+void BoxShadowHelperTest::testSeparable()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const QImage shadow = boxShadowAlpha(boxSize, radius, dpr, Algorithm::Separable);
+    const QImage reference = referenceBoxBlur(rasterizedBox(boxSize, radius, dpr), qRound(radius * dpr));
+
+    // The reference truncates after every box, while the profiles are not
+    // rounded until their product is, so they differ by a few levels.
+    QCOMPARE(shadow.size(), reference.size());
+    QVERIFY(maxDifference(shadow, reference) <= 3);
+}
+
+void BoxShadowHelperTest::testDownsampledBoxBlur_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const QSize &boxSize : { QSize(1, 1), QSize(17, 9), QSize(129, 129) }) {
+        for (const int radius : { 32, 50, 64, 100, 128, 200 }) {
+            for (const qreal dpr : { 1.0, 1.5, 2.0 }) {
+                if (qRound(radius * dpr) < 64 || qRound(radius * dpr) > 300) {
+                    continue;
+                }
+                QTest::addRow("%dx%d, radius %d, dpr %g", boxSize.width(), boxSize.height(), radius, dpr)
+                    << boxSize << radius << dpr;
+            }
+        }
+    }
+}
+
+void BoxShadowHelperTest::testDownsampledBoxBlur()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const QImage shadow = boxShadowAlpha(boxSize, radius, dpr, Algorithm::BoxBlur);
+    const QImage reference = referenceBoxBlur(rasterizedBox(boxSize, radius, dpr), qRound(radius * dpr));
+
+    // Blurring at a reduced resolution is not exact, but it must stay
+    // within a few alpha levels of the full resolution blur.
+    QCOMPARE(shadow.size(), reference.size());
+    QVERIFY(maxDifference(shadow, reference) <= 3);
+}
+
+void BoxShadowHelperTest::testRecursiveGaussian_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    // The recursive filter is too coarse for smaller radii.
+    for (const QSize &boxSize : { QSize(1, 1), QSize(17, 9), QSize(129, 129) }) {
+        for (const int radius : { 10, 25, 40, 63, 100 }) {
+            for (const qreal dpr : { 1.0, 1.5, 2.0 }) {
+                QTest::addRow("%dx%d, radius %d, dpr %g", boxSize.width(), boxSize.height(), radius, dpr)
+                    << boxSize << radius << dpr;
+            }
+        }
+    }
+}
+
+void BoxShadowHelperTest::testRecursiveGaussian()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const QImage shadow = boxShadowAlpha(boxSize, radius, dpr, Algorithm::RecursiveGaussian);
+    const QImage reference = ShadowReference::gaussianShadowAlpha(boxSize, radius, dpr);
+
+    QCOMPARE(shadow.size(), reference.size());
+    QVERIFY(maxDifference(shadow, reference) <= 8);
+}
+
+void BoxShadowHelperTest::testMultithreadedBlur_data()
+{
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<int>("bandCount");
+
+    for (const int bandCount : { 2, 3, 7 }) {
+        QTest::addRow("box blur, %d bands", bandCount) << 20 << bandCount;
+        QTest::addRow("small box blur, %d bands", bandCount) << 2 << bandCount;
+        QTest::addRow("downsampled box blur, %d bands", bandCount) << 200 << bandCount;
+    }
+}
+
+void BoxShadowHelperTest::testMultithreadedBlur()
+{
+    QFETCH(int, radius);
+    QFETCH(int, bandCount);
+
+    // Bands must not change the result, wherever they are split. The band
+    // count is fixed, so the blur is split even with a single CPU.
+    const QSize boxSize(601, 397);
+
+    setBlurBandCount(1);
+    const QImage singleThreaded = boxShadowAlpha(boxSize, radius, 1.0, Algorithm::BoxBlur);
+    setBlurBandCount(bandCount);
+    const QImage multithreaded = boxShadowAlpha(boxSize, radius, 1.0, Algorithm::BoxBlur);
+    setBlurBandCount(0);
+
+    QCOMPARE(multithreaded.size(), singleThreaded.size());
+    QCOMPARE(maxDifference(multithreaded, singleThreaded), 0);
+}
+
+void BoxShadowHelperTest::testTintRow_data()
+{
+    QTest::addColumn<bool>("over");
+    QTest::addColumn<int>("count");
+
+    for (const bool over : { false, true }) {
+        for (const int count : { 1, 3, 4, 5, 7, 8, 9, 15, 17, 256, 263 }) {
+            QTest::addRow("%s, %d pixels", over ? "source-over" : "source", count) << over << count;
+        }
+    }
+}
+
+void BoxShadowHelperTest::testTintRow()
+{
+    QFETCH(bool, over);
+    QFETCH(int, count);
+
+    const QVector<QRgb> colors = {
+        qRgba(0, 0, 0, 0),
+        qRgba(0, 0, 0, 255),
+        qRgba(0, 0, 0, 61),
+        qRgba(255, 255, 255, 255),
+        qRgba(255, 0, 0, 128),
+        qRgba(51, 102, 204, 233),
+    };
+
+    std::mt19937 generator(count);
+    std::uniform_int_distribution<uint> distribution;
+
+    // The pixels under a source-over tint are premultiplied.
+    QVector<QRgb> background(count);
+    for (QRgb &pixel : background) {
+        pixel = qPremultiply(distribution(generator));
+    }
+
+    // Shifting the row by one alpha value at a time sends every alpha
+    // value through every lane of the SIMD kernels and through the scalar
+    // tail.
+    QVector<uchar> alpha(256 + count);
+    for (int i = 0; i < alpha.count(); ++i) {
+        alpha[i] = i;
+    }
+
+    const QVector<TintRowFunc> kernels = tintRowKernels(over);
+
+    for (const QRgb color : colors) {
+        const uint pixel = qPremultiply(color);
+        for (int start = 0; start < 256; ++start) {
+            QVector<QRgb> expected = background;
+            kernels.first()(alpha.constData() + start, expected.data(), count, pixel);
+
+            for (const TintRowFunc kernel : kernels.mid(1)) {
+                QVector<QRgb> output = background;
+                kernel(alpha.constData() + start, output.data(), count, pixel);
+                QCOMPARE(output, expected);
+            }
+        }
+    }
+}
+
+void BoxShadowHelperTest::testCompositeShadowAlpha_data()
+{
+    QTest::addColumn<int>("elevation");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const int elevation : elevationLevels()) {
+        for (const qreal dpr : { 1.0, 1.25, 1.5, 2.0, 3.0 }) {
+            QTest::addRow("%ddp, dpr %.2f", elevation, dpr) << elevation << dpr;
+        }
+    }
+}
+
+void BoxShadowHelperTest::testCompositeShadowAlpha()
+{
+    QFETCH(int, elevation);
+    QFETCH(qreal, dpr);
+
+    const CompositeShadowParams params = elevationShadowParams(elevation);
+    const QRect box = params.box();
+    const QRect rect = compositeShadowRect(box, params.layers);
+
+    const QImage composite = compositeShadowAlpha(box, params.layers, dpr, Algorithm::Separable);
+    QCOMPARE(composite.size(), rect.size() * dpr);
+
+    // Layers of the same color drawn on top of each other with source-over,
+    // with their opacities and the blended alpha kept in floating point.
+    QVector<qreal> expected(composite.width() * composite.height(), 0);
+    for (const ShadowLayer &layer : params.layers) {
+        const QImage alpha = boxShadowAlpha(box.size(), layer.radius, dpr, Algorithm::Separable);
+
+        QRect layerRect(QPoint(0, 0), box.size() + 2 * QSize(layer.radius, layer.radius));
+        layerRect.moveCenter(box.center() + layer.offset);
+        const QPoint position = (layerRect.topLeft() - rect.topLeft()) * dpr;
+
+        for (int y = 0; y < alpha.height(); ++y) {
+            const int compositeY = y + position.y();
+            if (compositeY < 0 || compositeY >= composite.height()) {
+                continue;
+            }
+            for (int x = 0; x < alpha.width(); ++x) {
+                const int compositeX = x + position.x();
+                if (compositeX < 0 || compositeX >= composite.width()) {
+                    continue;
+                }
+                qreal &dst = expected[compositeY * composite.width() + compositeX];
+                const qreal src = alpha.constScanLine(y)[x] / 255.0 * layer.opacity;
+                dst += src * (1 - dst);
+            }
+        }
+    }
+
+    qreal maxError = 0;
+    for (int y = 0; y < composite.height(); ++y) {
+        for (int x = 0; x < composite.width(); ++x) {
+            const qreal error = qAbs(composite.constScanLine(y)[x] - 255 * expected[y * composite.width() + x]);
+            maxError = qMax(maxError, error);
+        }
+    }
+
+    // Every blend is rounded to 8 bits once.
+    QVERIFY2(maxError <= 1, qPrintable(QStringLiteral("Error of %1 alpha levels").arg(maxError)));
+}
+
+QTEST_GUILESS_MAIN(BoxShadowHelperTest)
+
+#include "BoxShadowHelperTest.moc"
@@ -0,0 +1,191 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "BoxShadowHelper.h"
+#include "BoxShadowHelper_p.h"
+#include "CompositeShadowParams.h"
+#include "ScratchArena.h"
+
+// Qt
+#include <QTest>
+
+using namespace Material;
+using namespace Material::BoxShadowHelper;
+
+Q_DECLARE_METATYPE(Algorithm)
+
+namespace
+{
+
+const int RADII[] = { 0, 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+const qreal DEVICE_PIXEL_RATIOS[] = { 1.0, 1.25, 1.5, 2.0, 3.0 };
+
+} // anonymous namespace
+
+class BoxShadowBenchmark : public QObject
+{
+    Q_OBJECT
+
+private Q_SLOTS:
+    void benchmarkBoxShadowAlpha_data();
+    void benchmarkBoxShadowAlpha();
+
+    void benchmarkTiledTranspose_data();
+    void benchmarkTiledTranspose();
+
+    void benchmarkCompositeShadowAlpha_data();
+    void benchmarkCompositeShadowAlpha();
+
+    void benchmarkComputeBoxSizes_data();
+    void benchmarkComputeBoxSizes();
+};
+
+void BoxShadowBenchmark::benchmarkBoxShadowAlpha_data()
+{
+    QTest::addColumn<Algorithm>("algorithm");
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const Algorithm algorithm : { Algorithm::BoxBlur, Algorithm::Separable, Algorithm::RecursiveGaussian }) {
+        for (const QSize &boxSize : { QSize(32, 32), QSize(256, 256), QSize(1024, 768) }) {
+            for (const int radius : RADII) {
+                for (const qreal dpr : DEVICE_PIXEL_RATIOS) {
+                    QTest::addRow("%s, %dx%d, radius %d, dpr %g", algorithmName(algorithm),
+                                  boxSize.width(), boxSize.height(), radius, dpr)
+                        << algorithm << boxSize << radius << dpr;
+                }
+            }
+        }
+    }
+}
+
+void BoxShadowBenchmark::benchmarkBoxShadowAlpha()
+{
+    QFETCH(Algorithm, algorithm);
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    // The arena is reused like the decoration does, so only the first
+    // iteration pays for its memory.
+    ScratchArena arena;
+    QBENCHMARK {
+        boxShadowAlpha(boxSize, radius, dpr, algorithm, &arena);
+        arena.reset();
+    }
+}
+
+void BoxShadowBenchmark::benchmarkTiledTranspose_data()
+{
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<bool>("tiled");
+
+    for (const QSize &boxSize : { QSize(256, 192), QSize(1024, 768), QSize(2048, 1536) }) {
+        for (const int radius : { 8, 16, 64 }) {
+            for (const bool tiled : { true, false }) {
+                QTest::addRow("%dx%d, radius %d, %s", boxSize.width(), boxSize.height(), radius,
+                              tiled ? "tiled" : "direct")
+                    << boxSize << radius << tiled;
+            }
+        }
+    }
+}
+
+void BoxShadowBenchmark::benchmarkTiledTranspose()
+{
+    QFETCH(QSize, boxSize);
+    QFETCH(int, radius);
+    QFETCH(bool, tiled);
+
+    // Both variants only differ in the horizontal pass, which runs on a
+    // single thread here.
+    setBlurBandCount(1);
+    setTiledTransposeEnabled(tiled);
+
+    ScratchArena arena;
+    QBENCHMARK {
+        boxShadowAlpha(boxSize, radius, 1.0, Algorithm::BoxBlur, &arena);
+        arena.reset();
+    }
+
+    setTiledTransposeEnabled(true);
+    setBlurBandCount(0);
+}
+
+void BoxShadowBenchmark::benchmarkCompositeShadowAlpha_data()
+{
+    QTest::addColumn<int>("elevation");
+    QTest::addColumn<QSize>("boxSize");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const int elevation : elevationLevels()) {
+        for (const QSize &boxSize : { QSize(32, 32), QSize(256, 256), QSize(1024, 768) }) {
+            for (const qreal dpr : DEVICE_PIXEL_RATIOS) {
+                QTest::addRow("elevation %d, %dx%d, dpr %g", elevation,
+                              boxSize.width(), boxSize.height(), dpr)
+                    << elevation << boxSize << dpr;
+            }
+        }
+    }
+}
+
+void BoxShadowBenchmark::benchmarkCompositeShadowAlpha()
+{
+    QFETCH(int, elevation);
+    QFETCH(QSize, boxSize);
+    QFETCH(qreal, dpr);
+
+    const QVector<ShadowLayer> layers = elevationShadowParams(elevation).layers;
+    const QRect box(QPoint(0, 0), boxSize);
+
+    // The decoration combines its layers from separable blurs.
+    ScratchArena arena;
+    QBENCHMARK {
+        compositeShadowAlpha(box, layers, dpr, Algorithm::Separable, &arena);
+        arena.reset();
+    }
+}
+
+void BoxShadowBenchmark::benchmarkComputeBoxSizes_data()
+{
+    QTest::addColumn<int>("radius");
+    QTest::addColumn<qreal>("dpr");
+
+    for (const int radius : RADII) {
+        for (const qreal dpr : DEVICE_PIXEL_RATIOS) {
+            QTest::addRow("radius %d, dpr %g", radius, dpr) << radius << dpr;
+        }
+    }
+}
+
+void BoxShadowBenchmark::benchmarkComputeBoxSizes()
+{
+    QFETCH(int, radius);
+    QFETCH(qreal, dpr);
+
+    const int deviceRadius = qRound(radius * dpr);
+    QBENCHMARK {
+        computeBoxSizes(deviceRadius, MAX_BLUR_ITERATIONS);
+    }
+}
+
+QTEST_GUILESS_MAIN(BoxShadowBenchmark)
+
+#include "BoxShadowBenchmark.moc"
@@ -0,0 +1,113 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Compares the shadows of every blur algorithm with an exact Gaussian
+// shadow of the same box, across radii and device pixel ratios, and prints
+// the max and mean alpha error together with the time each one took. If a
+// directory is given, the shadows are also saved there as PNG images.
+
+// own
+#include "BoxShadowHelper.h"
+#include "BoxShadowHelper_p.h"
+#include "ScratchArena.h"
+#include "ShadowReference.h"
+
+// Qt
+#include <QDir>
+#include <QElapsedTimer>
+#include <QString>
+
+// std
+#include <cstdio>
+
+using namespace Material;
+using namespace Material::BoxShadowHelper;
+
+int main(int argc, char **argv)
+{
+    if (argc > 2) {
+        std::fprintf(stderr, "Usage: %s [<png directory>]\n", argv[0]);
+        return 1;
+    }
+
+    QDir directory;
+    if (argc == 2) {
+        directory = QDir(QString::fromLocal8Bit(argv[1]));
+        if (!directory.mkpath(QStringLiteral("."))) {
+            std::fprintf(stderr, "Could not create %s\n", argv[1]);
+            return 1;
+        }
+    }
+
+    const QSize boxSize(64, 64);
+    const int radii[] = { 1, 2, 4, 8, 16, 32, 64, 128, 256 };
+    const qreal devicePixelRatios[] = { 1.0, 1.25, 1.5, 2.0, 3.0 };
+
+    std::printf("%-20s %6s %5s %6s %10s %10s\n", "algorithm", "radius", "dpr", "max", "mean", "ms");
+
+    ScratchArena arena;
+    for (const Algorithm algorithm : { Algorithm::BoxBlur, Algorithm::Separable, Algorithm::RecursiveGaussian }) {
+        for (const int radius : radii) {
+            for (const qreal dpr : devicePixelRatios) {
+                // The first run warms up the arena.
+                boxShadowAlpha(boxSize, radius, dpr, algorithm, &arena);
+                arena.reset();
+
+                QElapsedTimer timer;
+                timer.start();
+                const QImage shadow = boxShadowAlpha(boxSize, radius, dpr, algorithm, &arena);
+                const qint64 elapsed = timer.nsecsElapsed();
+
+                // The reference uses the standard deviation from the CSS
+                // spec, so the error includes the cost of every shortcut.
+                const QImage reference = ShadowReference::gaussianShadowAlpha(boxSize, radius, dpr);
+
+                int maxError = 0;
+                qint64 totalError = 0;
+                for (int y = 0; y < shadow.height(); ++y) {
+                    const uchar *alpha = shadow.constScanLine(y);
+                    const uchar *exact = reference.constScanLine(y);
+                    for (int x = 0; x < shadow.width(); ++x) {
+                        const int error = qAbs(alpha[x] - exact[x]);
+                        maxError = qMax(maxError, error);
+                        totalError += error;
+                    }
+                }
+
+                std::printf("%-20s %6d %5.2f %6d %10.3f %10.3f\n",
+                            algorithmName(algorithm), radius, dpr, maxError,
+                            qreal(totalError) / (shadow.width() * shadow.height()), elapsed / 1e6);
+
+                if (argc == 2) {
+                    const QImage image(shadow.constBits(), shadow.width(), shadow.height(),
+                                       shadow.bytesPerLine(), QImage::Format_Grayscale8);
+                    const QString fileName = QStringLiteral("%1-%2-%3.png")
+                        .arg(QString::fromLatin1(algorithmName(algorithm)).replace(QLatin1Char(' '), QLatin1Char('-')))
+                        .arg(radius)
+                        .arg(dpr);
+                    if (!image.save(directory.filePath(fileName))) {
+                        std::fprintf(stderr, "Could not save %s\n", qPrintable(fileName));
+                    }
+                }
+
+                arena.reset();
+            }
+        }
+    }
+
+    return 0;
+}
@@ -0,0 +1,51 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "BakedShadow.h"
+#include "CompositeShadowParams.h"
+
+// Qt
+#include <QVector>
+
+namespace Material
+{
+namespace BakedShadow
+{
+
+QImage alpha(const CompositeShadowParams &params)
+{
+    static const QVector<CompositeShadowParams> bakedParams = [] {
+        QVector<CompositeShadowParams> bakedParams;
+        for (int i = 0; i < entryCount; ++i) {
+            bakedParams.append(elevationShadowParams(entries[i].elevation));
+        }
+        return bakedParams;
+    }();
+
+    const int index = bakedParams.indexOf(params);
+    if (index == -1) {
+        return QImage();
+    }
+
+    // The image only wraps the data, which is never written.
+    const Entry &entry = entries[index];
+    return QImage(entry.data, entry.width, entry.height, entry.bytesPerLine, QImage::Format_Alpha8);
+}
+
+} // namespace BakedShadow
+} // namespace Material
@@ -0,0 +1,52 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Qt
+#include <QImage>
+#include <QtGlobal>
+
+namespace Material
+{
+
+struct CompositeShadowParams;
+
+namespace BakedShadow
+{
+
+// Alpha plane of the shadow of one elevation level. Entries are generated
+// by the bakeshadow tool at build time.
+struct Entry
+{
+    int elevation;
+    int width;
+    int height;
+    int bytesPerLine;
+    const uchar *data;
+};
+
+extern const Entry entries[];
+extern const int entryCount;
+
+// Returns the baked alpha plane for the given shadow, the same image as
+// CompositeShadowParams::alpha() would produce at a scale of 1. Returns a
+// null image if the shadow is not baked.
+QImage alpha(const CompositeShadowParams &params);
+
+} // namespace BakedShadow
+} // namespace Material
@@ -17,13 +17,23 @@
 
 // own
 #include "BoxShadowHelper.h"
+#include "BoxShadowHelper_p.h"
+#include "Logging.h"
+#include "ScratchArena.h"
 
 // Qt
+#include <QElapsedTimer>
+#include <QThread>
 #include <QVector>
+#include <QtConcurrentMap>
 
 // std
+#include <algorithm>
+#include <atomic>
 #include <cmath>
-
+#include <cstring>
+#include <new>
+#include <numeric>
 
 namespace Material
 {
@@ -39,22 +49,42 @@ namespace
 // blur scale, area under the kernel equals to 0.98, which is pretty enough.
 // Maybe, it should be changed in the future.
 const qreal SIGMA_BLUR_SCALE = 0.4375;
+
+// Images smaller than this (in pixels) are not worth the overhead of
+// dispatching the blur to worker threads.
+const int MULTITHREADED_BLUR_THRESHOLD = 256 * 256;
+const int MIN_ROWS_PER_BAND = 64;
+
+// Size of the square tiles the horizontal box blur pass collects its
+// output in before writing it back into the rows.
+const int TRANSPOSE_TILE_SIZE = 64;
+
+// Shadows with large radii have almost no high-frequency content, so they
+// are blurred at a reduced resolution and scaled back up. The estimated
+// interpolation error (in alpha levels) must stay below the tolerance, and
+// the reduced radius must stay large enough for the blur to remain smooth.
+const qreal DOWNSAMPLE_TOLERANCE = 1.0;
+const int MIN_DOWNSAMPLED_RADIUS = 32;
+const int MAX_DOWNSAMPLE_FACTOR = 4;
 } // anonymous namespace
 
+static std::atomic<int> s_blurBandCount(0);
+static std::atomic<bool> s_tiledTranspose(true);
+
 inline qreal radiusToSigma(qreal radius)
 {
     return radius * SIGMA_BLUR_SCALE;
 }
 
-inline int boxSizeToRadius(int boxSize)
-{
-    return (boxSize - 1) / 2;
-}
-
 QVector<int> computeBoxSizes(int radius, int numIterations)
 {
     const qreal sigma = radiusToSigma(radius);
 
+    // A box of size one leaves the image as is.
+    if (sigma <= 0 || numIterations <= 0) {
+        return QVector<int>(qMax(numIterations, 0), 1);
+    }
+
     // Box sizes are computed according to the "Fast Almost-Gaussian Filtering"
     // paper by Peter Kovesi.
     int lower = std::floor(std::sqrt(12 * std::pow(sigma, 2) / numIterations + 1));
@@ -62,9 +92,11 @@ QVector<int> computeBoxSizes(int radius, int numIterations)
         lower--;
     }
 
+    // The number of lower boxes is clamped so that rounding can never ask
+    // for more boxes than there are iterations.
     const int upper = lower + 2;
-    const int threshold = std::round((12 * std::pow(sigma, 2) - numIterations * std::pow(lower, 2)
-        - 4 * numIterations * lower - 3 * numIterations) / (-4 * lower - 4));
+    const int threshold = qBound(0, int(std::round((12 * std::pow(sigma, 2) - numIterations * std::pow(lower, 2)
+        - 4 * numIterations * lower - 3 * numIterations) / (-4 * lower - 4))), numIterations);
 
     QVector<int> boxSizes;
     boxSizes.reserve(numIterations);
@@ -75,98 +107,1345 @@ QVector<int> computeBoxSizes(int radius, int numIterations)
     return boxSizes;
 }
 
-void boxBlurPass(const QImage &src, QImage &dst, int boxSize)
+inline bool isInsideRow(int x, int width)
+{
+    return uint(x) < uint(width);
+}
+
+void boxBlurSteps(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                  int firstStep, int lastStep, uchar *dst, int dstStride)
+{
+    const int stageCount = cascade.boxSizes.count();
+    const int latency = cascadeLatency(cascade);
+    const uchar *srcAlpha = cascade.src + y * cascade.srcStride;
+
+    int windows[MAX_BLUR_ITERATIONS];
+    int positions[MAX_BLUR_ITERATIONS];
+    for (int i = 0; i < stageCount; ++i) {
+        windows[i] = state.windows[i];
+        positions[i] = state.positions[i];
+    }
+
+    for (int x = firstStep; x < lastStep; ++x) {
+        int alpha = isInsideRow(x, cascade.width) ? srcAlpha[x] : 0;
+
+        qint32 *ring = state.rings;
+        int delay = 0;
+        for (int i = 0; i < stageCount; ++i) {
+            const int boxSize = cascade.boxSizes[i];
+            if (!isInsideRow(x - delay, cascade.width)) {
+                alpha = 0;
+            }
+
+            windows[i] += alpha - ring[positions[i]];
+            ring[positions[i]] = alpha;
+            if (++positions[i] == boxSize) {
+                positions[i] = 0;
+            }
+
+            alpha = (windows[i] * quint64(cascade.reciprocals[i])) >> RECIPROCAL_SHIFT;
+            ring += boxSize;
+            delay += boxSizeToRadius(boxSize);
+        }
+
+        if (x >= latency) {
+            *dst = static_cast<uchar>(alpha);
+            dst += dstStride;
+        }
+    }
+
+    for (int i = 0; i < stageCount; ++i) {
+        state.windows[i] = windows[i];
+        state.positions[i] = positions[i];
+    }
+}
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+// The SIMD kernels blur several rows at once, one row per 32-bit lane.
+// Results for consecutive rows land in consecutive bytes of the output,
+// so every step ends in a single narrow store. The division uses the same fixed-point
+// reciprocal as the scalar reference, so the results are bit-identical.
+
+__attribute__((target("sse2")))
+inline __m128i loadAlphaSse2(const uchar *const *rows, int x)
+{
+    return _mm_set_epi32(rows[3][x], rows[2][x], rows[1][x], rows[0][x]);
+}
+
+__attribute__((target("sse2")))
+inline __m128i divideSse2(__m128i window, __m128i reciprocal)
+{
+    const __m128i even = _mm_srli_epi64(_mm_mul_epu32(window, reciprocal), RECIPROCAL_SHIFT);
+    const __m128i odd = _mm_srli_epi64(_mm_mul_epu32(_mm_srli_epi64(window, 32), reciprocal), RECIPROCAL_SHIFT);
+    return _mm_or_si128(even, _mm_slli_epi64(odd, 32));
+}
+
+__attribute__((target("sse2")))
+inline void storeAlphaSse2(uchar *dst, __m128i alpha)
+{
+    const __m128i packed = _mm_packus_epi16(_mm_packs_epi32(alpha, alpha), alpha);
+    const int bytes = _mm_cvtsi128_si32(packed);
+    std::memcpy(dst, &bytes, sizeof(bytes));
+}
+
+__attribute__((target("sse2")))
+void boxBlurStepsSse2(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                      int firstStep, int lastStep, uchar *dst, int dstStride)
+{
+    const int stageCount = cascade.boxSizes.count();
+    const int latency = cascadeLatency(cascade);
+
+    const uchar *rows[4];
+    for (int i = 0; i < 4; ++i) {
+        rows[i] = cascade.src + (y + i) * cascade.srcStride;
+    }
+
+    __m128i reciprocals[MAX_BLUR_ITERATIONS];
+    __m128i windows[MAX_BLUR_ITERATIONS];
+    int positions[MAX_BLUR_ITERATIONS];
+    for (int i = 0; i < stageCount; ++i) {
+        reciprocals[i] = _mm_set1_epi32(cascade.reciprocals[i]);
+        windows[i] = _mm_loadu_si128(reinterpret_cast<const __m128i *>(state.windows + 4 * i));
+        positions[i] = state.positions[i];
+    }
+
+    for (int x = firstStep; x < lastStep; ++x) {
+        __m128i alpha = isInsideRow(x, cascade.width) ? loadAlphaSse2(rows, x) : _mm_setzero_si128();
+
+        qint32 *ring = state.rings;
+        int delay = 0;
+        for (int i = 0; i < stageCount; ++i) {
+            const int boxSize = cascade.boxSizes[i];
+            if (!isInsideRow(x - delay, cascade.width)) {
+                alpha = _mm_setzero_si128();
+            }
+
+            __m128i *slot = reinterpret_cast<__m128i *>(ring + 4 * positions[i]);
+            windows[i] = _mm_add_epi32(windows[i], _mm_sub_epi32(alpha, _mm_loadu_si128(slot)));
+            _mm_storeu_si128(slot, alpha);
+            if (++positions[i] == boxSize) {
+                positions[i] = 0;
+            }
+
+            alpha = divideSse2(windows[i], reciprocals[i]);
+            ring += 4 * boxSize;
+            delay += boxSizeToRadius(boxSize);
+        }
+
+        if (x >= latency) {
+            storeAlphaSse2(dst, alpha);
+            dst += dstStride;
+        }
+    }
+
+    for (int i = 0; i < stageCount; ++i) {
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(state.windows + 4 * i), windows[i]);
+        state.positions[i] = positions[i];
+    }
+}
+
+__attribute__((target("avx2")))
+inline __m256i loadAlphaAvx2(const uchar *const *rows, int x)
+{
+    return _mm256_setr_epi32(rows[0][x], rows[1][x], rows[2][x], rows[3][x],
+                             rows[4][x], rows[5][x], rows[6][x], rows[7][x]);
+}
+
+__attribute__((target("avx2")))
+inline __m256i divideAvx2(__m256i window, __m256i reciprocal)
+{
+    const __m256i even = _mm256_srli_epi64(_mm256_mul_epu32(window, reciprocal), RECIPROCAL_SHIFT);
+    const __m256i odd = _mm256_srli_epi64(_mm256_mul_epu32(_mm256_srli_epi64(window, 32), reciprocal), RECIPROCAL_SHIFT);
+    return _mm256_or_si256(even, _mm256_slli_epi64(odd, 32));
+}
+
+__attribute__((target("avx2")))
+inline void storeAlphaAvx2(uchar *dst, __m256i alpha)
+{
+    const __m128i words = _mm_packs_epi32(_mm256_castsi256_si128(alpha), _mm256_extracti128_si256(alpha, 1));
+    _mm_storel_epi64(reinterpret_cast<__m128i *>(dst), _mm_packus_epi16(words, words));
+}
+
+__attribute__((target("avx2")))
+void boxBlurStepsAvx2(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                      int firstStep, int lastStep, uchar *dst, int dstStride)
+{
+    const int stageCount = cascade.boxSizes.count();
+    const int latency = cascadeLatency(cascade);
+
+    const uchar *rows[8];
+    for (int i = 0; i < 8; ++i) {
+        rows[i] = cascade.src + (y + i) * cascade.srcStride;
+    }
+
+    __m256i reciprocals[MAX_BLUR_ITERATIONS];
+    __m256i windows[MAX_BLUR_ITERATIONS];
+    int positions[MAX_BLUR_ITERATIONS];
+    for (int i = 0; i < stageCount; ++i) {
+        reciprocals[i] = _mm256_set1_epi32(cascade.reciprocals[i]);
+        windows[i] = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(state.windows + 8 * i));
+        positions[i] = state.positions[i];
+    }
+
+    for (int x = firstStep; x < lastStep; ++x) {
+        __m256i alpha = isInsideRow(x, cascade.width) ? loadAlphaAvx2(rows, x) : _mm256_setzero_si256();
+
+        qint32 *ring = state.rings;
+        int delay = 0;
+        for (int i = 0; i < stageCount; ++i) {
+            const int boxSize = cascade.boxSizes[i];
+            if (!isInsideRow(x - delay, cascade.width)) {
+                alpha = _mm256_setzero_si256();
+            }
+
+            __m256i *slot = reinterpret_cast<__m256i *>(ring + 8 * positions[i]);
+            windows[i] = _mm256_add_epi32(windows[i], _mm256_sub_epi32(alpha, _mm256_loadu_si256(slot)));
+            _mm256_storeu_si256(slot, alpha);
+            if (++positions[i] == boxSize) {
+                positions[i] = 0;
+            }
+
+            alpha = divideAvx2(windows[i], reciprocals[i]);
+            ring += 8 * boxSize;
+            delay += boxSizeToRadius(boxSize);
+        }
+
+        if (x >= latency) {
+            storeAlphaAvx2(dst, alpha);
+            dst += dstStride;
+        }
+    }
+
+    for (int i = 0; i < stageCount; ++i) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(state.windows + 8 * i), windows[i]);
+        state.positions[i] = positions[i];
+    }
+}
+#endif // MATERIAL_HAVE_X86_SIMD
+
+BoxBlurKernel resolveBoxBlurKernel()
+{
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return { 8, boxBlurStepsAvx2 };
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return { 4, boxBlurStepsSse2 };
+    }
+#endif
+    return { 1, boxBlurSteps };
+}
+
+// A group of rows that share one sweep of a kernel. The row is relative
+// to the block of rows the group belongs to.
+struct BoxBlurGroup
+{
+    BoxBlurGroup(const BoxBlurKernel &kernel, const BoxBlurCascade &cascade, int row, ScratchArena &arena)
+        : kernel(kernel)
+        , row(row)
+        , state(cascade, kernel.lanes, arena)
+    {
+    }
+
+    BoxBlurKernel kernel;
+    int row;
+    BoxBlurState state;
+};
+
+// Splits a block of rows into as many SIMD groups as possible; the
+// remaining rows are blurred one by one. There is at most one group per
+// row, and the number of groups is returned.
+int makeBoxBlurGroups(const BoxBlurCascade &cascade, int rowCount, BoxBlurGroup *groups, ScratchArena &arena)
+{
+    static const BoxBlurKernel kernel = resolveBoxBlurKernel();
+    static const BoxBlurKernel scalarKernel = { 1, boxBlurSteps };
+
+    int count = 0;
+    int row = 0;
+    for (; row + kernel.lanes <= rowCount; row += kernel.lanes) {
+        new (groups + count++) BoxBlurGroup(kernel, cascade, row, arena);
+    }
+    for (; row < rowCount; ++row) {
+        new (groups + count++) BoxBlurGroup(scalarKernel, cascade, row, arena);
+    }
+    return count;
+}
+
+// Blurs rows in place. The kernels store results for a group of rows in
+// consecutive bytes, so they are collected in a small tile, a few columns
+// at a time, and the tile is transposed back into the rows while it is
+// still in L1.
+void boxBlurRows(const BoxBlurCascade &cascade, int firstRow, int lastRow, ScratchArena &arena)
 {
-    const int alphaStride = src.depth() >> 3;
-    const int alphaOffset = QSysInfo::ByteOrder == QSysInfo::BigEndian ? 0 : 3;
+    const int latency = cascadeLatency(cascade);
+    uchar tile[TRANSPOSE_TILE_SIZE * TRANSPOSE_TILE_SIZE];
 
-    const int radius = boxSizeToRadius(boxSize);
-    const qreal invSize = 1.0 / boxSize;
+    // All blocks but the last one have the same rows, so the groups and
+    // their buffers are only set up again when that changes. Groups only
+    // point into the arena, so they need no destruction.
+    BoxBlurGroup *groups = arena.allocate<BoxBlurGroup>(TRANSPOSE_TILE_SIZE);
+    int groupCount = 0;
+    int groupRowCount = 0;
 
-    const int dstStride = dst.width() * alphaStride;
+    for (int y = firstRow; y < lastRow; y += TRANSPOSE_TILE_SIZE) {
+        const int rowCount = qMin(TRANSPOSE_TILE_SIZE, lastRow - y);
+        if (rowCount != groupRowCount) {
+            groupCount = makeBoxBlurGroups(cascade, rowCount, groups, arena);
+            groupRowCount = rowCount;
+        } else {
+            for (int i = 0; i < groupCount; ++i) {
+                groups[i].state.reset();
+            }
+        }
 
-    for (int y = 0; y < src.height(); ++y) {
-        const uchar *srcAlpha = src.scanLine(y);
-        uchar *dstAlpha = dst.scanLine(0);
+        for (int x = 0; x < cascade.width; x += TRANSPOSE_TILE_SIZE) {
+            const int columnCount = qMin(TRANSPOSE_TILE_SIZE, cascade.width - x);
 
-        srcAlpha += alphaOffset;
-        dstAlpha += alphaOffset + y * alphaStride;
+            // The first tile also has to fill the pipeline of the cascade.
+            // Columns are read ahead of the ones written, so the source
+            // can be overwritten.
+            const int firstStep = x == 0 ? 0 : x + latency;
+            const int lastStep = x + columnCount + latency;
+            for (int i = 0; i < groupCount; ++i) {
+                BoxBlurGroup &group = groups[i];
+                group.kernel.steps(cascade, y + group.row, group.state, firstStep, lastStep,
+                                   tile + group.row, TRANSPOSE_TILE_SIZE);
+            }
 
-        const uchar *left = srcAlpha;
-        const uchar *right = left + alphaStride * radius;
+            for (int i = 0; i < rowCount; ++i) {
+                const uchar *tileColumn = tile + i;
+                uchar *dstAlpha = cascade.dst + (y + i) * cascade.dstStride + x;
+                for (int j = 0; j < columnCount; ++j) {
+                    dstAlpha[j] = tileColumn[j * TRANSPOSE_TILE_SIZE];
+                }
+            }
+        }
+    }
+}
+
+// Blurs rows in place, one at a time, with the scalar kernel. Its results
+// go straight into the row, so there is no tile, but no SIMD either.
+void boxBlurRowsDirect(const BoxBlurCascade &cascade, int firstRow, int lastRow, ScratchArena &arena)
+{
+    const int latency = cascadeLatency(cascade);
+    BoxBlurState state(cascade, 1, arena);
 
+    // Columns are read ahead of the ones written, so the source can be
+    // overwritten.
+    for (int y = firstRow; y < lastRow; ++y) {
+        state.reset();
+        boxBlurSteps(cascade, y, state, 0, cascade.width + latency, cascade.dst + y * cascade.dstStride, 1);
+    }
+}
+
+// Thin shadows only need a few small boxes. A small box is cheaper to
+// sum directly than with a running sum: every output column is then
+// independent, so a row is blurred 16 columns at a time without going
+// through the tile. Each stage reads a copy of its input that is padded
+// with zeros, which matches how the cascade treats the edges of a row.
+const int MAX_SMALL_BOX_SIZE = 7;
+const int SMALL_BOX_PADDING = (MAX_SMALL_BOX_SIZE - 1) / 2;
+
+using SmallBoxBlurStageFunc = void (*)(const uchar *src, uchar *dst, int width);
+
+template <int BoxSize>
+void smallBoxBlurStage(const uchar *src, uchar *dst, int width)
+{
+    const int radius = boxSizeToRadius(BoxSize);
+    for (int x = 0; x < width; ++x) {
         int window = 0;
-        for (int x = 0; x < radius; ++x) {
-            window += *srcAlpha;
-            srcAlpha += alphaStride;
+        for (int i = -radius; i <= radius; ++i) {
+            window += src[x + i];
         }
+        dst[x] = static_cast<uchar>(window / BoxSize);
+    }
+}
 
-        for (int x = 0; x <= radius; ++x) {
-            window += *right;
-            right += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
+#ifdef MATERIAL_HAVE_X86_SIMD
+// A window of a small box fits in 16 bits, so the division is a 16-bit
+// multiplication by a fixed-point reciprocal. It is exact for windows of
+// up to 255 * BoxSize.
+template <int BoxSize>
+struct SmallBoxDivisor
+{
+    static const int shift = BoxSize < 4 ? 1 : 2;
+    static const int reciprocal = ((1 << (16 + shift)) + BoxSize - 1) / BoxSize;
+};
+
+template <int BoxSize>
+__attribute__((target("sse2")))
+void smallBoxBlurStageSse2(const uchar *src, uchar *dst, int width)
+{
+    static_assert(BoxSize <= MAX_SMALL_BOX_SIZE, "The reciprocal is only exact for small boxes");
+
+    const int radius = boxSizeToRadius(BoxSize);
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i reciprocal = _mm_set1_epi16(short(SmallBoxDivisor<BoxSize>::reciprocal));
+
+    int x = 0;
+    for (; x + 16 <= width; x += 16) {
+        __m128i low = zero;
+        __m128i high = zero;
+        for (int i = -radius; i <= radius; ++i) {
+            const __m128i alpha = _mm_loadu_si128(reinterpret_cast<const __m128i *>(src + x + i));
+            low = _mm_add_epi16(low, _mm_unpacklo_epi8(alpha, zero));
+            high = _mm_add_epi16(high, _mm_unpackhi_epi8(alpha, zero));
         }
+        low = _mm_srli_epi16(_mm_mulhi_epu16(low, reciprocal), SmallBoxDivisor<BoxSize>::shift);
+        high = _mm_srli_epi16(_mm_mulhi_epu16(high, reciprocal), SmallBoxDivisor<BoxSize>::shift);
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(dst + x), _mm_packus_epi16(low, high));
+    }
+
+    smallBoxBlurStage<BoxSize>(src + x, dst + x, width - x);
+}
+#endif // MATERIAL_HAVE_X86_SIMD
+
+template <int BoxSize>
+SmallBoxBlurStageFunc resolveSmallBoxBlurStage()
+{
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("sse2")) {
+        return smallBoxBlurStageSse2<BoxSize>;
+    }
+#endif
+    return smallBoxBlurStage<BoxSize>;
+}
+
+// Returns the kernel for a box of the given size, or null if the box is
+// not small. Boxes of up to size 7 cover radii of up to 9 device pixels.
+SmallBoxBlurStageFunc smallBoxBlurStageForSize(int boxSize)
+{
+    static const SmallBoxBlurStageFunc stages[] = {
+        resolveSmallBoxBlurStage<3>(),
+        resolveSmallBoxBlurStage<5>(),
+        resolveSmallBoxBlurStage<7>(),
+    };
+
+    switch (boxSize) {
+    case 3:
+        return stages[0];
+    case 5:
+        return stages[1];
+    case 7:
+        return stages[2];
+    default:
+        return nullptr;
+    }
+}
+
+// Blurs rows in place. The stages ping-pong between two padded buffers,
+// and the last one writes straight into the row.
+void smallBoxBlurRows(const BoxBlurCascade &cascade, const QVector<SmallBoxBlurStageFunc> &stages,
+                      int firstRow, int lastRow, ScratchArena &arena)
+{
+    const int bufferSize = cascade.width + 2 * SMALL_BOX_PADDING;
+    uchar *buffers[2];
+    for (uchar *&buffer : buffers) {
+        buffer = arena.allocate<uchar>(bufferSize);
+        std::fill_n(buffer, bufferSize, 0);
+        buffer += SMALL_BOX_PADDING;
+    }
 
-        for (int x = radius + 1; x < src.width() - radius; ++x) {
-            window += *right - *left;
-            left += alphaStride;
-            right += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
+    for (int y = firstRow; y < lastRow; ++y) {
+        uchar *row = cascade.dst + y * cascade.dstStride;
+        std::memcpy(buffers[0], row, cascade.width);
+
+        for (int i = 0; i < stages.count(); ++i) {
+            uchar *dst = i == stages.count() - 1 ? row : buffers[(i + 1) % 2];
+            stages[i](buffers[i % 2], dst, cascade.width);
         }
+    }
+}
+
+void boxBlurColumnsStep(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                        int count, quint32 reciprocal)
+{
+    for (int x = 0; x < count; ++x) {
+        const int alpha = src[x];
+        windows[x] += alpha - ring[x];
+        ring[x] = alpha;
+        dst[x] = static_cast<uchar>((windows[x] * quint64(reciprocal)) >> RECIPROCAL_SHIFT);
+    }
+}
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+inline __m128i loadBytesSse2(const uchar *src)
+{
+    int bytes;
+    std::memcpy(&bytes, src, sizeof(bytes));
+    const __m128i zero = _mm_setzero_si128();
+    return _mm_unpacklo_epi16(_mm_unpacklo_epi8(_mm_cvtsi32_si128(bytes), zero), zero);
+}
+
+__attribute__((target("sse2")))
+void boxBlurColumnsStepSse2(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                            int count, quint32 reciprocal)
+{
+    const __m128i factor = _mm_set1_epi32(reciprocal);
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        const __m128i alpha = loadBytesSse2(src + x);
+        __m128i window = _mm_loadu_si128(reinterpret_cast<const __m128i *>(windows + x));
+        window = _mm_add_epi32(window, _mm_sub_epi32(alpha, loadBytesSse2(ring + x)));
+        _mm_storeu_si128(reinterpret_cast<__m128i *>(windows + x), window);
+        std::memcpy(ring + x, src + x, 4);
+        storeAlphaSse2(dst + x, divideSse2(window, factor));
+    }
+
+    boxBlurColumnsStep(src + x, ring + x, windows + x, dst + x, count - x, reciprocal);
+}
+
+__attribute__((target("avx2")))
+void boxBlurColumnsStepAvx2(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                            int count, quint32 reciprocal)
+{
+    const __m256i factor = _mm256_set1_epi32(reciprocal);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        const __m256i alpha = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x)));
+        const __m256i old = _mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i *>(ring + x)));
+        __m256i window = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(windows + x));
+        window = _mm256_add_epi32(window, _mm256_sub_epi32(alpha, old));
+        _mm256_storeu_si256(reinterpret_cast<__m256i *>(windows + x), window);
+        std::memcpy(ring + x, src + x, 8);
+        storeAlphaAvx2(dst + x, divideAvx2(window, factor));
+    }
 
-        for (int x = src.width() - radius; x < src.width(); ++x) {
-            window -= *left;
-            left += alphaStride;
-            *dstAlpha = static_cast<uchar>(window * invSize);
-            dstAlpha += dstStride;
+    boxBlurColumnsStep(src + x, ring + x, windows + x, dst + x, count - x, reciprocal);
+}
+#endif // MATERIAL_HAVE_X86_SIMD
+
+BoxBlurColumnsStepFunc resolveBoxBlurColumnsStep()
+{
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return boxBlurColumnsStepAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return boxBlurColumnsStepSse2;
+    }
+#endif
+    return boxBlurColumnsStep;
+}
+
+// Blurs columns [firstColumn, lastColumn) in place. A row is overwritten
+// only after every stage has consumed it.
+void boxBlurColumns(const BoxBlurCascade &cascade, int height, int firstColumn, int lastColumn,
+                    ScratchArena &arena)
+{
+    static const BoxBlurColumnsStepFunc blurStep = resolveBoxBlurColumnsStep();
+
+    const int stageCount = cascade.boxSizes.count();
+    const int latency = cascadeLatency(cascade);
+    const int count = lastColumn - firstColumn;
+
+    const int ringSize = count * std::accumulate(cascade.boxSizes.begin(), cascade.boxSizes.end(), 0);
+    uchar *rings = arena.allocate<uchar>(ringSize);
+    qint32 *windows = arena.allocate<qint32>(count * stageCount);
+    uchar *outputs = arena.allocate<uchar>(count * stageCount);
+    uchar *zeros = arena.allocate<uchar>(count);
+    int positions[MAX_BLUR_ITERATIONS] = {};
+
+    std::fill_n(rings, ringSize, 0);
+    std::fill_n(windows, count * stageCount, 0);
+    std::fill_n(zeros, count, 0);
+
+    for (int y = 0; y < height + latency; ++y) {
+        const uchar *src = y < height
+            ? cascade.src + y * cascade.srcStride + firstColumn
+            : zeros;
+
+        uchar *ring = rings;
+        int delay = 0;
+        for (int i = 0; i < stageCount; ++i) {
+            const int boxSize = cascade.boxSizes[i];
+            if (!isInsideRow(y - delay, height)) {
+                src = zeros;
+            }
+
+            uchar *dst = outputs + i * count;
+            if (i == stageCount - 1 && y >= latency) {
+                dst = cascade.dst + (y - latency) * cascade.dstStride + firstColumn;
+            }
+
+            blurStep(src, ring + positions[i] * count, windows + i * count, dst,
+                     count, cascade.reciprocals[i]);
+            if (++positions[i] == boxSize) {
+                positions[i] = 0;
+            }
+
+            src = dst;
+            ring += boxSize * count;
+            delay += boxSizeToRadius(boxSize);
         }
     }
 }
 
-void boxBlurAlpha(QImage &image, int radius, int numIterations)
+BoxBlurCascade makeBoxBlurCascade(QImage &image, const QVector<int> &boxSizes)
+{
+    // Both passes work in place.
+    BoxBlurCascade cascade;
+    cascade.dst = image.bits();
+    cascade.dstStride = image.bytesPerLine();
+    cascade.src = cascade.dst;
+    cascade.srcStride = cascade.dstStride;
+    cascade.width = image.width();
+    cascade.boxSizes = boxSizes;
+    for (const int &boxSize : boxSizes) {
+        cascade.reciprocals.append(boxSizeToReciprocal(boxSize));
+    }
+    return cascade;
+}
+
+// Splits [0, size) into bands and processes them on worker threads if
+// the image is large enough, or if a band count is set.
+template <typename Func>
+void forEachBand(const QImage &image, int size, int alignment, Func func)
 {
-    // Temporary buffer is transposed so we always read memory
-    // in linear order.
-    QImage tmp(image.height(), image.width(), image.format());
+    const int fixedBandCount = s_blurBandCount.load();
+    int bandCount = 1;
+    if (fixedBandCount > 0) {
+        bandCount = qBound(1, size / alignment, fixedBandCount);
+    } else if (image.width() * image.height() >= MULTITHREADED_BLUR_THRESHOLD) {
+        bandCount = qBound(1, size / MIN_ROWS_PER_BAND, QThread::idealThreadCount());
+    }
 
-    const QVector<int> boxSizes = computeBoxSizes(radius, numIterations);
+    if (bandCount == 1) {
+        func(0, size);
+        return;
+    }
+
+    QVector<int> bands(bandCount);
+    std::iota(bands.begin(), bands.end(), 0);
+
+    QtConcurrent::blockingMap(bands, [&func, size, alignment, bandCount](int band) {
+        const int first = band == 0 ? 0 : size * band / bandCount / alignment * alignment;
+        const int last = band == bandCount - 1 ? size : size * (band + 1) / bandCount / alignment * alignment;
+        func(first, last);
+    });
+}
+
+void boxBlurAlpha(QImage &image, int radius, int numIterations, ScratchArena &arena)
+{
+    // Boxes of size one leave the image as is, so they are dropped.
+    QVector<int> boxSizes = computeBoxSizes(radius, qMin(numIterations, MAX_BLUR_ITERATIONS));
+    boxSizes.removeAll(1);
+    if (boxSizes.isEmpty()) {
+        return;
+    }
+
+    const BoxBlurCascade cascade = makeBoxBlurCascade(image, boxSizes);
+
+    QVector<SmallBoxBlurStageFunc> smallStages;
     for (const int &boxSize : boxSizes) {
-        boxBlurPass(image, tmp, boxSize); // horizontal pass
-        boxBlurPass(tmp, image, boxSize); // vertical pass
+        smallStages.append(smallBoxBlurStageForSize(boxSize));
     }
+    if (smallStages.contains(nullptr)) {
+        smallStages.clear();
+    }
+
+    // Rows are independent in the horizontal pass, and columns are
+    // independent in the vertical one, so each pass can be split into
+    // bands. Column bands are aligned to cache lines.
+    forEachBand(image, image.height(), 1, [&cascade, &smallStages, &arena](int firstRow, int lastRow) {
+        if (!smallStages.isEmpty()) {
+            smallBoxBlurRows(cascade, smallStages, firstRow, lastRow, arena);
+        } else if (s_tiledTranspose.load()) {
+            boxBlurRows(cascade, firstRow, lastRow, arena);
+        } else {
+            boxBlurRowsDirect(cascade, firstRow, lastRow, arena);
+        }
+    });
+    forEachBand(image, image.width(), 64, [&cascade, &image, &arena](int firstColumn, int lastColumn) {
+        boxBlurColumns(cascade, image.height(), firstColumn, lastColumn, arena);
+    });
 }
 
-void boxShadow(QPainter *p, const QRect &box, const QPoint &offset, int radius, const QColor &color)
+void setBlurBandCount(int count)
 {
-    const QSize size = box.size() + 2 * QSize(radius, radius);
-    const qreal dpr = p->device()->devicePixelRatioF();
+    s_blurBandCount = count;
+}
 
-    QPainter painter;
+void setTiledTransposeEnabled(bool enabled)
+{
+    s_tiledTranspose = enabled;
+}
 
-    QImage shadow(size * dpr, QImage::Format_ARGB32_Premultiplied);
-    shadow.setDevicePixelRatio(dpr);
-    shadow.fill(Qt::transparent);
+QVector<qreal> blurredStepProfile(int size, int start, int length, const QVector<int> &boxSizes)
+{
+    QVector<qreal> profile(size, 0);
+    std::fill(profile.begin() + start, profile.begin() + start + length, 1);
+
+    QVector<qreal> blurred(size);
+    for (const int &boxSize : boxSizes) {
+        const int radius = boxSizeToRadius(boxSize);
+
+        qreal window = 0;
+        for (int x = 0; x < qMin(radius, size); ++x) {
+            window += profile[x];
+        }
+
+        for (int x = 0; x < size; ++x) {
+            if (x + radius < size) {
+                window += profile[x + radius];
+            }
+            blurred[x] = window / boxSize;
+            if (x - radius >= 0) {
+                window -= profile[x - radius];
+            }
+        }
+
+        profile.swap(blurred);
+    }
+
+    return profile;
+}
+
+void separableBoxShadow(QImage &shadow, const QRect &boxRect, int radius, int numIterations)
+{
+    // A blurred axis-aligned rectangle is the outer product of its blurred
+    // horizontal and vertical profiles, so there is no need to blur the
+    // whole image.
+    const QVector<int> boxSizes = computeBoxSizes(radius, numIterations);
+    const QVector<qreal> horizontal = blurredStepProfile(shadow.width(), boxRect.x(), boxRect.width(), boxSizes);
+    const QVector<qreal> vertical = blurredStepProfile(shadow.height(), boxRect.y(), boxRect.height(), boxSizes);
+
+    for (int y = 0; y < shadow.height(); ++y) {
+        const qreal scale = 255 * vertical[y];
+        uchar *dst = shadow.scanLine(y);
+        for (int x = 0; x < shadow.width(); ++x) {
+            dst[x] = static_cast<uchar>(scale * horizontal[x] + 0.5);
+        }
+    }
+}
+
+// Creates an image that either owns its pixels or uses memory from the arena.
+QImage createImage(const QSize &size, QImage::Format format, ScratchArena *arena)
+{
+    if (!arena) {
+        return QImage(size, format);
+    }
+
+    const int bytesPerLine = (size.width() * QImage::toPixelFormat(format).bitsPerPixel() / 8 + 3) & ~3;
+    uchar *data = arena->allocate<uchar>(bytesPerLine * size.height());
+    return QImage(data, size.width(), size.height(), bytesPerLine, format);
+}
+
+inline uint multiplyByAlpha(uint x, uint a)
+{
+    uint t = (x & 0xff00ff) * a;
+    t = (t + ((t >> 8) & 0xff00ff) + 0x800080) >> 8;
+    t &= 0xff00ff;
+
+    x = ((x >> 8) & 0xff00ff) * a;
+    x = (x + ((x >> 8) & 0xff00ff) + 0x800080);
+    x &= 0xff00ff00;
+
+    return x | t;
+}
+
+// The SIMD kernels work on 16-bit channels and round exactly like
+// multiplyByAlpha(), so they match the scalar kernels.
+void tintRow(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    for (int x = 0; x < count; ++x) {
+        dst[x] = multiplyByAlpha(pixel, src[x]);
+    }
+}
+
+void tintRowOver(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    for (int x = 0; x < count; ++x) {
+        const uint tinted = multiplyByAlpha(pixel, src[x]);
+        dst[x] = tinted + multiplyByAlpha(dst[x], 255 - qAlpha(tinted));
+    }
+}
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+inline __m128i multiplyByAlphaSse2(__m128i x, __m128i a)
+{
+    const __m128i t = _mm_mullo_epi16(x, a);
+    return _mm_srli_epi16(_mm_add_epi16(t, _mm_add_epi16(_mm_srli_epi16(t, 8), _mm_set1_epi16(0x80))), 8);
+}
+
+// Returns the alpha channel of two pixels with 16-bit channels in every
+// channel of the pixel.
+__attribute__((target("sse2")))
+inline __m128i broadcastAlphaSse2(__m128i x)
+{
+    return _mm_shufflehi_epi16(_mm_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+template <bool over>
+__attribute__((target("sse2")))
+inline void tintPixelsSse2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i color = _mm_unpacklo_epi8(_mm_set1_epi32(pixel), zero);
+    const __m128i full = _mm_set1_epi16(0xff);
+
+    int x = 0;
+    for (; x + 4 <= count; x += 4) {
+        int bytes;
+        std::memcpy(&bytes, src + x, sizeof(bytes));
+        __m128i alpha = _mm_cvtsi32_si128(bytes);
+        alpha = _mm_unpacklo_epi8(alpha, alpha);
+        alpha = _mm_unpacklo_epi16(alpha, alpha);
+
+        __m128i lo = multiplyByAlphaSse2(color, _mm_unpacklo_epi8(alpha, zero));
+        __m128i hi = multiplyByAlphaSse2(color, _mm_unpackhi_epi8(alpha, zero));
+
+        __m128i *target = reinterpret_cast<__m128i *>(dst + x);
+        if (over) {
+            const __m128i pixels = _mm_loadu_si128(target);
+            lo = _mm_add_epi16(lo, multiplyByAlphaSse2(_mm_unpacklo_epi8(pixels, zero),
+                                                       _mm_sub_epi16(full, broadcastAlphaSse2(lo))));
+            hi = _mm_add_epi16(hi, multiplyByAlphaSse2(_mm_unpackhi_epi8(pixels, zero),
+                                                       _mm_sub_epi16(full, broadcastAlphaSse2(hi))));
+        }
+
+        _mm_storeu_si128(target, _mm_packus_epi16(lo, hi));
+    }
+
+    if (over) {
+        tintRowOver(src + x, dst + x, count - x, pixel);
+    } else {
+        tintRow(src + x, dst + x, count - x, pixel);
+    }
+}
+
+__attribute__((target("sse2")))
+void tintRowSse2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    tintPixelsSse2<false>(src, dst, count, pixel);
+}
+
+__attribute__((target("sse2")))
+void tintRowOverSse2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    tintPixelsSse2<true>(src, dst, count, pixel);
+}
+
+__attribute__((target("avx2")))
+inline __m256i multiplyByAlphaAvx2(__m256i x, __m256i a)
+{
+    const __m256i t = _mm256_mullo_epi16(x, a);
+    return _mm256_srli_epi16(_mm256_add_epi16(t, _mm256_add_epi16(_mm256_srli_epi16(t, 8), _mm256_set1_epi16(0x80))), 8);
+}
+
+__attribute__((target("avx2")))
+inline __m256i broadcastAlphaAvx2(__m256i x)
+{
+    return _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(x, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+}
+
+template <bool over>
+__attribute__((target("avx2")))
+inline void tintPixelsAvx2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    const __m256i zero = _mm256_setzero_si256();
+    const __m256i color = _mm256_unpacklo_epi8(_mm256_set1_epi32(pixel), zero);
+    const __m256i full = _mm256_set1_epi16(0xff);
+    const __m256i spread = _mm256_set1_epi32(0x01010101);
+
+    int x = 0;
+    for (; x + 8 <= count; x += 8) {
+        // Every byte of a pixel gets its alpha value.
+        const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i *>(src + x));
+        const __m256i alpha = _mm256_mullo_epi32(_mm256_cvtepu8_epi32(bytes), spread);
+
+        __m256i lo = multiplyByAlphaAvx2(color, _mm256_unpacklo_epi8(alpha, zero));
+        __m256i hi = multiplyByAlphaAvx2(color, _mm256_unpackhi_epi8(alpha, zero));
 
-    painter.begin(&shadow);
-    painter.fillRect(QRect(QPoint(radius, radius), box.size()), Qt::black);
-    painter.end();
+        __m256i *target = reinterpret_cast<__m256i *>(dst + x);
+        if (over) {
+            const __m256i pixels = _mm256_loadu_si256(target);
+            lo = _mm256_add_epi16(lo, multiplyByAlphaAvx2(_mm256_unpacklo_epi8(pixels, zero),
+                                                          _mm256_sub_epi16(full, broadcastAlphaAvx2(lo))));
+            hi = _mm256_add_epi16(hi, multiplyByAlphaAvx2(_mm256_unpackhi_epi8(pixels, zero),
+                                                          _mm256_sub_epi16(full, broadcastAlphaAvx2(hi))));
+        }
+
+        _mm256_storeu_si256(target, _mm256_packus_epi16(lo, hi));
+    }
+
+    if (over) {
+        tintRowOver(src + x, dst + x, count - x, pixel);
+    } else {
+        tintRow(src + x, dst + x, count - x, pixel);
+    }
+}
+
+__attribute__((target("avx2")))
+void tintRowAvx2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    tintPixelsAvx2<false>(src, dst, count, pixel);
+}
+
+__attribute__((target("avx2")))
+void tintRowOverAvx2(const uchar *src, QRgb *dst, int count, uint pixel)
+{
+    tintPixelsAvx2<true>(src, dst, count, pixel);
+}
+#endif // MATERIAL_HAVE_X86_SIMD
+
+TintRowFunc resolveTintRow(TintMode mode)
+{
+    const bool over = mode == TintMode::SourceOver;
+#ifdef MATERIAL_HAVE_X86_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        return over ? tintRowOverAvx2 : tintRowAvx2;
+    }
+    if (__builtin_cpu_supports("sse2")) {
+        return over ? tintRowOverSse2 : tintRowSse2;
+    }
+#endif
+    return over ? tintRowOver : tintRow;
+}
+
+void tintAlpha(QImage &dst, const QPoint &position, const QImage &alpha, const QColor &color, TintMode mode)
+{
+    static const TintRowFunc tintSource = resolveTintRow(TintMode::Source);
+    static const TintRowFunc tintSourceOver = resolveTintRow(TintMode::SourceOver);
+    const TintRowFunc tint = mode == TintMode::Source ? tintSource : tintSourceOver;
+
+    const uint pixel = qPremultiply(color.rgba());
+    const QRect rect = QRect(position, alpha.size()) & dst.rect();
+
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar *src = alpha.constScanLine(y - position.y()) + rect.left() - position.x();
+        QRgb *target = reinterpret_cast<QRgb *>(dst.scanLine(y)) + rect.left();
+        tint(src, target, rect.width(), pixel);
+    }
+}
+
+QImage tintAlpha(const QImage &alpha, const QColor &color, ScratchArena *arena)
+{
+    QImage image = createImage(alpha.size(), QImage::Format_ARGB32_Premultiplied, arena);
+    image.setDevicePixelRatio(alpha.devicePixelRatio());
+    tintAlpha(image, QPoint(0, 0), alpha, color, TintMode::Source);
+    return image;
+}
 
-    // There is no need to blur RGB channels. Blur the alpha
-    // channel and then give the shadow a tint of the desired color.
+// Coefficients of the recursive Gaussian filter from "Recursive
+// implementation of the Gaussian filter" by Ian T. Young and
+// Lucas J. van Vliet.
+struct RecursiveGaussianCoefficients
+{
+    explicit RecursiveGaussianCoefficients(qreal sigma)
+    {
+        const qreal q = sigma >= 2.5
+            ? 0.98711 * sigma - 0.96330
+            : 3.97156 - 4.14554 * std::sqrt(1 - 0.26891 * sigma);
+
+        const qreal q2 = q * q;
+        const qreal q3 = q2 * q;
+
+        const qreal b0 = 1.57825 + 2.44413 * q + 1.4281 * q2 + 0.422205 * q3;
+        b1 = (2.44413 * q + 2.85619 * q2 + 1.26661 * q3) / b0;
+        b2 = -(1.4281 * q2 + 1.26661 * q3) / b0;
+        b3 = 0.422205 * q3 / b0;
+        scale = 1 - (b1 + b2 + b3);
+
+        computeBoundaryMatrix(sigma);
+    }
+
+    // The backward pass can't start from a zero state because the signal
+    // beyond the edge is still non-zero after the forward pass. Find out
+    // how the last three forward outputs propagate into the initial state
+    // of the backward pass if the input is zero past the edge, as in
+    // "Boundary conditions for Young-van Vliet recursive filtering" by
+    // Bill Triggs and Michael Sdika.
+    void computeBoundaryMatrix(qreal sigma)
+    {
+        QVector<qreal> tail(static_cast<int>(std::ceil(6 * sigma)) + 16);
+
+        for (int i = 0; i < 3; ++i) {
+            qreal w[3] = {0, 0, 0};
+            w[i] = 1;
+            for (qreal &value : tail) {
+                value = b1 * w[0] + b2 * w[1] + b3 * w[2];
+                w[2] = w[1];
+                w[1] = w[0];
+                w[0] = value;
+            }
+
+            qreal v[3] = {0, 0, 0};
+            for (int j = tail.size() - 1; j >= 0; --j) {
+                tail[j] = scale * tail[j] + b1 * v[0] + b2 * v[1] + b3 * v[2];
+                v[2] = v[1];
+                v[1] = v[0];
+                v[0] = tail[j];
+            }
+
+            for (int j = 0; j < 3; ++j) {
+                boundary[j][i] = tail[j];
+            }
+        }
+    }
+
+    void initBackward(float &w1, float &w2, float &w3) const
+    {
+        const float u1 = w1, u2 = w2, u3 = w3;
+        w1 = boundary[0][0] * u1 + boundary[0][1] * u2 + boundary[0][2] * u3;
+        w2 = boundary[1][0] * u1 + boundary[1][1] * u2 + boundary[1][2] * u3;
+        w3 = boundary[2][0] * u1 + boundary[2][1] * u2 + boundary[2][2] * u3;
+    }
+
+    float scale;
+    float b1;
+    float b2;
+    float b3;
+    float boundary[3][3];
+};
+
+void recursiveGaussianRows(float *data, int width, int height, const RecursiveGaussianCoefficients &c)
+{
+    for (int y = 0; y < height; ++y) {
+        float *row = data + y * width;
+
+        float w1 = 0, w2 = 0, w3 = 0;
+        for (int x = 0; x < width; ++x) {
+            const float w0 = c.scale * row[x] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+            row[x] = w0;
+            w3 = w2;
+            w2 = w1;
+            w1 = w0;
+        }
+
+        c.initBackward(w1, w2, w3);
+        for (int x = width - 1; x >= 0; --x) {
+            const float w0 = c.scale * row[x] + c.b1 * w1 + c.b2 * w2 + c.b3 * w3;
+            row[x] = w0;
+            w3 = w2;
+            w2 = w1;
+            w1 = w0;
+        }
+    }
+}
+
+void recursiveGaussianColumns(float *data, int width, int height, const RecursiveGaussianCoefficients &c,
+                              ScratchArena &arena)
+{
+    // All columns are filtered at once, row by row, so memory is
+    // still accessed in linear order.
+    float *history = arena.allocate<float>(3 * width);
+    std::fill_n(history, 3 * width, 0.0f);
+    float *w1 = history;
+    float *w2 = w1 + width;
+    float *w3 = w2 + width;
+
+    for (int y = 0; y < height; ++y) {
+        float *row = data + y * width;
+        for (int x = 0; x < width; ++x) {
+            row[x] = c.scale * row[x] + c.b1 * w1[x] + c.b2 * w2[x] + c.b3 * w3[x];
+        }
+        std::swap(w3, w2);
+        std::swap(w2, w1);
+        std::copy(row, row + width, w1);
+    }
+
+    for (int x = 0; x < width; ++x) {
+        c.initBackward(w1[x], w2[x], w3[x]);
+    }
+    for (int y = height - 1; y >= 0; --y) {
+        float *row = data + y * width;
+        for (int x = 0; x < width; ++x) {
+            row[x] = c.scale * row[x] + c.b1 * w1[x] + c.b2 * w2[x] + c.b3 * w3[x];
+        }
+        std::swap(w3, w2);
+        std::swap(w2, w1);
+        std::copy(row, row + width, w1);
+    }
+}
+
+void recursiveGaussianAlpha(QImage &image, int radius, ScratchArena &arena)
+{
+    const qreal sigma = 0.5 * radius;
+
+    // The filter is not defined for very small standard deviations,
+    // and the result would be indistinguishable from the box anyway.
+    if (sigma < 0.5) {
+        return;
+    }
+
+    const int width = image.width();
+    const int height = image.height();
+
+    float *data = arena.allocate<float>(width * height);
+    for (int y = 0; y < height; ++y) {
+        const uchar *src = image.constScanLine(y);
+        std::copy(src, src + width, data + y * width);
+    }
+
+    const RecursiveGaussianCoefficients coefficients(sigma);
+    recursiveGaussianRows(data, width, height, coefficients);
+    recursiveGaussianColumns(data, width, height, coefficients, arena);
+
+    for (int y = 0; y < height; ++y) {
+        const float *src = data + y * width;
+        uchar *dst = image.scanLine(y);
+        for (int x = 0; x < width; ++x) {
+            dst[x] = static_cast<uchar>(qBound(0.0f, src[x] + 0.5f, 255.0f));
+        }
+    }
+}
+
+int downsampleFactor(int radius)
+{
+    // Linear interpolation between samples that are h pixels apart is off
+    // by at most h^2 / 8 * max|f''|. For a blurred edge, the maximum of
+    // |f''| is 255 * 0.242 / sigma^2.
+    const qreal sigma = radiusToSigma(radius);
+    const qreal curvature = 255 * 0.242 / (sigma * sigma);
+
+    int factor = 1;
+    while (factor < MAX_DOWNSAMPLE_FACTOR) {
+        const int next = 2 * factor;
+        if (next * next / 8.0 * curvature > DOWNSAMPLE_TOLERANCE) {
+            break;
+        }
+        if (radius / next < MIN_DOWNSAMPLED_RADIUS) {
+            break;
+        }
+        factor = next;
+    }
+
+    return factor;
+}
+
+QVector<int> boxCoverage(int size, int start, int length, int factor)
+{
+    QVector<int> coverage(size);
+    for (int i = 0; i < size; ++i) {
+        const int from = qMax(i * factor, start);
+        const int to = qMin((i + 1) * factor, start + length);
+        coverage[i] = qMax(0, to - from);
+    }
+    return coverage;
+}
+
+// Rasterizes the box into an image that is |factor| times smaller than the
+// shadow. Pixels on the edges of the box get partial coverage.
+void rasterizeBox(QImage &image, const QRect &boxRect, int factor)
+{
+    const QVector<int> columns = boxCoverage(image.width(), boxRect.left(), boxRect.width(), factor);
+    const QVector<int> rows = boxCoverage(image.height(), boxRect.top(), boxRect.height(), factor);
+    const int area = factor * factor;
+
+    for (int y = 0; y < image.height(); ++y) {
+        uchar *dst = image.scanLine(y);
+        for (int x = 0; x < image.width(); ++x) {
+            dst[x] = (255 * columns[x] * rows[y] + area / 2) / area;
+        }
+    }
+}
+
+struct BilinearTap
+{
+    int first;
+    int second;
+    int weight; // Weight of the second sample, out of 256.
+};
+
+QVector<BilinearTap> bilinearTaps(int size, int srcSize, int factor)
+{
+    QVector<BilinearTap> taps(size);
+    for (int i = 0; i < size; ++i) {
+        const qreal u = qBound<qreal>(0, (i + 0.5) / factor - 0.5, srcSize - 1);
+        const int first = static_cast<int>(u);
+        taps[i].first = first;
+        taps[i].second = qMin(first + 1, srcSize - 1);
+        taps[i].weight = qRound((u - first) * 256);
+    }
+    return taps;
+}
+
+void upsampleBilinear(const QImage &src, QImage &dst, int factor, ScratchArena &arena)
+{
+    const QVector<BilinearTap> columns = bilinearTaps(dst.width(), src.width(), factor);
+    const QVector<BilinearTap> rows = bilinearTaps(dst.height(), src.height(), factor);
+
+    quint32 *row = arena.allocate<quint32>(src.width());
+    for (int y = 0; y < dst.height(); ++y) {
+        const BilinearTap &ty = rows[y];
+        const uchar *a = src.constScanLine(ty.first);
+        const uchar *b = src.constScanLine(ty.second);
+        for (int x = 0; x < src.width(); ++x) {
+            row[x] = a[x] * (256 - ty.weight) + b[x] * ty.weight;
+        }
+
+        uchar *out = dst.scanLine(y);
+        for (int x = 0; x < dst.width(); ++x) {
+            const BilinearTap &tx = columns[x];
+            out[x] = (row[tx.first] * (256 - tx.weight) + row[tx.second] * tx.weight + (1 << 15)) >> 16;
+        }
+    }
+}
+
+const char *algorithmName(Algorithm algorithm)
+{
+    switch (algorithm) {
+    case Algorithm::BoxBlur:
+        return "box blur";
+    case Algorithm::Separable:
+        return "separable";
+    case Algorithm::RecursiveGaussian:
+        return "recursive gaussian";
+    }
+    return "unknown";
+}
+
+QImage boxShadowAlpha(const QSize &boxSize, int radius, qreal dpr, Algorithm algorithm, ScratchArena *arena)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    ScratchArena localArena;
+    ScratchArena &scratch = arena ? *arena : localArena;
+
+    const QSize size = boxSize + 2 * QSize(radius, radius);
+
+    // There is no need to blur RGB channels. Blur a single alpha channel
+    // and then give the shadow a tint of the desired color.
+    QImage shadow = createImage(size * dpr, QImage::Format_Alpha8, arena);
+    shadow.setDevicePixelRatio(dpr);
+
+    const QRect boxRect = QRect(QPoint(radius, radius) * dpr, boxSize * dpr);
+    const int deviceRadius = qRound(radius * dpr);
     const int numIterations = 3;
-    boxBlurAlpha(shadow, radius, numIterations);
 
-    painter.begin(&shadow);
-    painter.setCompositionMode(QPainter::CompositionMode_SourceIn);
-    painter.fillRect(shadow.rect(), color);
-    painter.end();
+    auto blur = [algorithm, numIterations, &scratch](QImage &image, int radius) {
+        if (algorithm == Algorithm::BoxBlur) {
+            boxBlurAlpha(image, radius, numIterations, scratch);
+        } else {
+            recursiveGaussianAlpha(image, radius, scratch);
+        }
+    };
+
+    const int factor = algorithm == Algorithm::Separable ? 1 : downsampleFactor(deviceRadius);
+
+    // Without a radius the shadow is the box itself.
+    if (deviceRadius == 0) {
+        rasterizeBox(shadow, boxRect, 1);
+    } else if (algorithm == Algorithm::Separable) {
+        separableBoxShadow(shadow, boxRect, deviceRadius, numIterations);
+    } else if (factor > 1) {
+        const QSize downsampledSize((shadow.width() + factor - 1) / factor,
+                                    (shadow.height() + factor - 1) / factor);
+        QImage downsampled = createImage(downsampledSize, QImage::Format_Alpha8, &scratch);
+        rasterizeBox(downsampled, boxRect, factor);
+        blur(downsampled, qRound(qreal(deviceRadius) / factor));
+        upsampleBilinear(downsampled, shadow, factor, scratch);
+    } else {
+        rasterizeBox(shadow, boxRect, 1);
+        blur(shadow, deviceRadius);
+    }
+
+    qCDebug(MATERIAL_SHADOW, "Generated %dx%d shadow (%s, radius %d, dpr %.2f) in %.3f ms",
+            shadow.width(), shadow.height(), algorithmName(algorithm), radius, dpr,
+            timer.nsecsElapsed() / 1e6);
+
+    return shadow;
+}
+
+void boxShadow(QPainter *p, const QRect &box, const QPoint &offset, int radius, const QColor &color,
+               Algorithm algorithm, ScratchArena *arena)
+{
+    // A hard shadow needs neither a blur nor an image.
+    if (radius == 0) {
+        p->fillRect(box.translated(offset), color);
+        return;
+    }
+
+    // Both images are only needed until they are drawn.
+    ScratchArena localArena;
+    ScratchArena *scratch = arena ? arena : &localArena;
+
+    const qreal dpr = p->device()->devicePixelRatioF();
+    const QImage shadow = boxShadowAlpha(box.size(), radius, dpr, algorithm, scratch);
 
     QRect shadowRect = shadow.rect();
     shadowRect.setSize(shadowRect.size() / dpr);
     shadowRect.moveCenter(box.center() + offset);
-    p->drawImage(shadowRect, shadow);
+    p->drawImage(shadowRect, tintAlpha(shadow, color, scratch));
+}
+
+static QRect layerRect(const QRect &box, const ShadowLayer &layer)
+{
+    QRect rect(QPoint(0, 0), box.size() + 2 * QSize(layer.radius, layer.radius));
+    rect.moveCenter(box.center() + layer.offset);
+    return rect;
+}
+
+QRect compositeShadowRect(const QRect &box, const QVector<ShadowLayer> &layers)
+{
+    QRect rect;
+    for (const ShadowLayer &layer : layers) {
+        rect |= layerRect(box, layer);
+    }
+    return rect;
+}
+
+// Combines the alpha plane of a layer into the composite at the given
+// position. For layers of the same color, drawing with source-over only
+// changes the alpha: a + b * (1 - a). The opacity is kept with 16 bits and
+// every blend is rounded once, which keeps the composite within one level
+// of the exact blend.
+static void compositeAlpha(QImage &composite, const QImage &alpha, const QPoint &position, uint opacity)
+{
+    const quint64 scale = 255 * 65535;
+
+    const QRect rect = QRect(position, alpha.size()) & composite.rect();
+
+    for (int y = rect.top(); y <= rect.bottom(); ++y) {
+        const uchar *src = alpha.constScanLine(y - position.y()) + rect.left() - position.x();
+        uchar *dst = composite.scanLine(y) + rect.left();
+        for (int x = 0; x < rect.width(); ++x) {
+            dst[x] += (quint64(src[x]) * opacity * (255 - dst[x]) + scale / 2) / scale;
+        }
+    }
+}
+
+QImage compositeShadowAlpha(const QRect &box, const QVector<ShadowLayer> &layers, qreal dpr,
+                            Algorithm algorithm, ScratchArena *arena)
+{
+    ScratchArena localArena;
+    ScratchArena &scratch = arena ? *arena : localArena;
+
+    const QRect rect = compositeShadowRect(box, layers);
+
+    QImage composite = createImage(rect.size() * dpr, QImage::Format_Alpha8, arena);
+    composite.setDevicePixelRatio(dpr);
+    composite.fill(0);
+
+    for (const ShadowLayer &layer : layers) {
+        const QImage alpha = boxShadowAlpha(box.size(), layer.radius, dpr, algorithm, &scratch);
+        const QPoint position = (layerRect(box, layer).topLeft() - rect.topLeft()) * dpr;
+        compositeAlpha(composite, alpha, position, qRound(layer.opacity * 65535));
+    }
+
+    return composite;
+}
+
+void compositeShadow(QPainter *p, const QRect &box, const QVector<ShadowLayer> &layers, const QColor &color,
+                     Algorithm algorithm, ScratchArena *arena)
+{
+    ScratchArena localArena;
+    ScratchArena *scratch = arena ? arena : &localArena;
+
+    const qreal dpr = p->device()->devicePixelRatioF();
+    const QImage composite = compositeShadowAlpha(box, layers, dpr, algorithm, scratch);
+
+    p->drawImage(compositeShadowRect(box, layers), tintAlpha(composite, color, scratch));
 }
 
 } // namespace BoxShadowHelper
@@ -19,17 +19,109 @@
 
 // Qt
 #include <QColor>
+#include <QImage>
 #include <QPainter>
 #include <QPoint>
 #include <QRect>
+#include <QSize>
+#include <QVector>
 
 namespace Material
 {
+
+class ScratchArena;
+
 namespace BoxShadowHelper
 {
 
+enum class Algorithm {
+    // Rasterize the box and blur it with a cascade of box blurs.
+    BoxBlur,
+    // Blur horizontal and vertical profiles of the box and fill the
+    // shadow with their outer product. Only valid for rectangular boxes.
+    Separable,
+    // Rasterize the box and blur it with a recursive Gaussian filter. The
+    // cost per pixel doesn't depend on the radius, and the filter uses the
+    // standard deviation from the CSS spec.
+    RecursiveGaussian
+};
+
+// One layer of a composite shadow.
+struct ShadowLayer
+{
+    ShadowLayer() = default;
+
+    ShadowLayer(const QPoint &offset, int radius, qreal opacity)
+        : offset(offset)
+        , radius(radius)
+        , opacity(opacity) {}
+
+    bool operator==(const ShadowLayer &other) const
+    {
+        return offset == other.offset
+            && radius == other.radius
+            && opacity == other.opacity;
+    }
+
+    QPoint offset;
+    int radius = 0;
+    qreal opacity = 0;
+};
+
+// How tinted pixels are combined with the destination.
+enum class TintMode {
+    // Replace the destination.
+    Source,
+    // Draw over the destination, which must be premultiplied.
+    SourceOver
+};
+
+// Large shadows are blurred in bands on worker threads. By default, the
+// number of bands depends on the size of the shadow and on the number of
+// CPUs, and a count of 0 restores that. A count of 1 disables threading,
+// and larger counts split every blur into that many bands, as far as the
+// image allows, which lets tests exercise the split on any machine.
+void setBlurBandCount(int count);
+
+// The horizontal pass of the box blur collects the output of its SIMD
+// kernels in small tiles and transposes them back into the rows. With the
+// tiles disabled, rows are blurred one at a time by the scalar kernel,
+// which writes straight into the row. That is kept as a fallback, and for
+// comparing the two.
+void setTiledTransposeEnabled(bool enabled);
+
+// Temporary buffers are taken from the arena if one is given. So is the
+// returned image, which then stays valid until the arena is reset.
+QImage boxShadowAlpha(const QSize &boxSize, int radius, qreal dpr,
+                      Algorithm algorithm = Algorithm::BoxBlur,
+                      ScratchArena *arena = nullptr);
+
 void boxShadow(QPainter *p, const QRect &box, const QPoint &offset,
-               int radius, const QColor &color);
+               int radius, const QColor &color,
+               Algorithm algorithm = Algorithm::BoxBlur,
+               ScratchArena *arena = nullptr);
+
+// Turns an alpha plane into the color scaled by it, and writes the result
+// straight into a premultiplied ARGB32 image at the given position in
+// device pixels.
+void tintAlpha(QImage &dst, const QPoint &position, const QImage &alpha, const QColor &color,
+               TintMode mode = TintMode::SourceOver);
+
+// Area covered by a composite shadow of the box, in logical pixels.
+QRect compositeShadowRect(const QRect &box, const QVector<ShadowLayer> &layers);
+
+// Blurs every layer into an alpha plane and combines them with their
+// offsets and opacities, as if they were drawn on top of each other with
+// the same color. The image covers compositeShadowRect().
+QImage compositeShadowAlpha(const QRect &box, const QVector<ShadowLayer> &layers, qreal dpr,
+                            Algorithm algorithm = Algorithm::BoxBlur,
+                            ScratchArena *arena = nullptr);
+
+// Draws a composite shadow. It costs one tint for all layers.
+void compositeShadow(QPainter *p, const QRect &box, const QVector<ShadowLayer> &layers,
+                     const QColor &color,
+                     Algorithm algorithm = Algorithm::BoxBlur,
+                     ScratchArena *arena = nullptr);
 
 } // namespace BoxShadowHelper
 } // namespace Material
@@ -0,0 +1,205 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Internals of the box blur and of the tinting. They are only exposed to tests and benchmarks.
+
+// own
+#include "BoxShadowHelper.h"
+#include "ScratchArena.h"
+
+// Qt
+#include <QImage>
+#include <QVector>
+
+// std
+#include <algorithm>
+#include <numeric>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define MATERIAL_HAVE_X86_SIMD
+#endif
+
+namespace Material
+{
+namespace BoxShadowHelper
+{
+
+// Name of the algorithm in logs and in the output of the tools.
+const char *algorithmName(Algorithm algorithm);
+
+// The fused box blur keeps the state of every iteration on the stack.
+const int MAX_BLUR_ITERATIONS = 3;
+
+inline int boxSizeToRadius(int boxSize)
+{
+    return (boxSize - 1) / 2;
+}
+
+// Sizes of the boxes whose cascade approximates a Gaussian blur with the
+// given radius.
+QVector<int> computeBoxSizes(int radius, int numIterations);
+
+// Dividing the window sum by the box size is done with a multiplication by
+// a fixed-point reciprocal followed by a shift. With the shift of 31 bits the
+// result is exactly floor(window / boxSize) for box sizes up to 2902.
+const int RECIPROCAL_SHIFT = 31;
+const int MAX_RECIPROCAL_BOX_SIZE = 2902;
+
+inline quint32 boxSizeToReciprocal(int boxSize)
+{
+    return ((quint64(1) << RECIPROCAL_SHIFT) + boxSize - 1) / boxSize;
+}
+
+// All iterations of the box blur are fused into a single sweep along each
+// row. Every stage keeps the last boxSize values of its input in a ring
+// buffer and feeds its output straight into the next stage, so the image
+// is read and written once per axis instead of once per iteration.
+struct BoxBlurCascade
+{
+    const uchar *src;
+    int srcStride;
+    uchar *dst;
+    int dstStride;
+    int width;
+    QVector<int> boxSizes;
+    QVector<quint32> reciprocals;
+};
+
+// Sets up a cascade that blurs the image in place.
+BoxBlurCascade makeBoxBlurCascade(QImage &image, const QVector<int> &boxSizes);
+
+// A stage sees column x of the row at step x + delay. Outside of the row
+// its input is zero, which is the same as padding the image with zeros.
+inline int stageDelay(const BoxBlurCascade &cascade, int stage)
+{
+    int delay = 0;
+    for (int i = 0; i < stage; ++i) {
+        delay += boxSizeToRadius(cascade.boxSizes[i]);
+    }
+    return delay;
+}
+
+inline int cascadeLatency(const BoxBlurCascade &cascade)
+{
+    return stageDelay(cascade, cascade.boxSizes.count());
+}
+
+// State of the cascade for a group of rows that are blurred together, one
+// row per lane. Keeping it outside of the kernels allows a sweep to be
+// interrupted and resumed, which lets the horizontal pass work in tiles.
+// The buffers are taken from the arena.
+struct BoxBlurState
+{
+    BoxBlurState(const BoxBlurCascade &cascade, int lanes, ScratchArena &arena)
+        : stageCount(cascade.boxSizes.count())
+        , windowCount(lanes * stageCount)
+        , ringSize(lanes * std::accumulate(cascade.boxSizes.begin(), cascade.boxSizes.end(), 0))
+        , windows(arena.allocate<qint32>(windowCount))
+        , positions(arena.allocate<int>(stageCount))
+        , rings(arena.allocate<qint32>(ringSize))
+    {
+        reset();
+    }
+
+    void reset()
+    {
+        std::fill_n(windows, windowCount, 0);
+        std::fill_n(positions, stageCount, 0);
+        std::fill_n(rings, ringSize, 0);
+    }
+
+    int stageCount;
+    int windowCount;
+    int ringSize;
+    qint32 *windows;
+    int *positions;
+    qint32 *rings;
+};
+
+// Advances rows [y, y + lanes) from step |firstStep| to |lastStep|. Every
+// step past the latency of the cascade produces one output column, which
+// is stored at |dst| and then |dst| moves by |dstStride|. The SIMD kernels
+// store the results of consecutive rows in consecutive bytes.
+using BoxBlurStepsFunc = void (*)(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                                  int firstStep, int lastStep, uchar *dst, int dstStride);
+
+struct BoxBlurKernel
+{
+    int lanes;
+    BoxBlurStepsFunc steps;
+};
+
+void boxBlurSteps(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                  int firstStep, int lastStep, uchar *dst, int dstStride);
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void boxBlurStepsSse2(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                      int firstStep, int lastStep, uchar *dst, int dstStride);
+
+__attribute__((target("avx2")))
+void boxBlurStepsAvx2(const BoxBlurCascade &cascade, int y, BoxBlurState &state,
+                      int firstStep, int lastStep, uchar *dst, int dstStride);
+#endif
+
+// The vertical pass keeps one running sum per column and streams rows from
+// top to bottom, so reads and writes stay linear and consecutive columns
+// map onto SIMD lanes. Every stage keeps the last boxSize rows of its input
+// in a ring of rows. A step feeds one row of |count| columns into a stage.
+using BoxBlurColumnsStepFunc = void (*)(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                                        int count, quint32 reciprocal);
+
+void boxBlurColumnsStep(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                        int count, quint32 reciprocal);
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void boxBlurColumnsStepSse2(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                            int count, quint32 reciprocal);
+
+__attribute__((target("avx2")))
+void boxBlurColumnsStepAvx2(const uchar *src, uchar *ring, qint32 *windows, uchar *dst,
+                            int count, quint32 reciprocal);
+#endif
+
+// Tinting turns every alpha value into the premultiplied color scaled by
+// it. The Over kernels blend the result over the pixels at |dst| with
+// source-over. All kernels produce identical pixels.
+using TintRowFunc = void (*)(const uchar *src, QRgb *dst, int count, uint pixel);
+
+void tintRow(const uchar *src, QRgb *dst, int count, uint pixel);
+void tintRowOver(const uchar *src, QRgb *dst, int count, uint pixel);
+
+#ifdef MATERIAL_HAVE_X86_SIMD
+__attribute__((target("sse2")))
+void tintRowSse2(const uchar *src, QRgb *dst, int count, uint pixel);
+
+__attribute__((target("sse2")))
+void tintRowOverSse2(const uchar *src, QRgb *dst, int count, uint pixel);
+
+__attribute__((target("avx2")))
+void tintRowAvx2(const uchar *src, QRgb *dst, int count, uint pixel);
+
+__attribute__((target("avx2")))
+void tintRowOverAvx2(const uchar *src, QRgb *dst, int count, uint pixel);
+#endif
+
+} // namespace BoxShadowHelper
+} // namespace Material
@@ -0,0 +1,99 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "CompositeShadowParams.h"
+
+namespace Material
+{
+
+using BoxShadowHelper::ShadowLayer;
+
+namespace
+{
+struct ElevationLevel
+{
+    int elevation;
+    int offset;
+    int shapeRadius;
+    qreal shapeOpacity;
+    int contrastOffset;
+    int contrastRadius;
+    qreal contrastOpacity;
+};
+
+// The standard Material elevations. The "shape" shadow grows and darkens
+// with the elevation, and the "contrast" shadow keeps the edges of the
+// window visible on dark backgrounds.
+const ElevationLevel s_elevationLevels[] = {
+    {  1,  1,  3, 0.61,   0,  1, 0.1 },
+    {  2,  2,  5, 0.62,  -1,  2, 0.1 },
+    {  3,  2,  8, 0.63,  -1,  3, 0.1 },
+    {  4,  3, 11, 0.63,  -2,  4, 0.1 },
+    {  6,  5, 16, 0.65,  -3,  6, 0.1 },
+    {  8,  6, 21, 0.67,  -3,  8, 0.1 },
+    { 12,  9, 32, 0.70,  -5, 12, 0.1 },
+    { 16, 12, 43, 0.73,  -7, 16, 0.1 },
+    { 24, 18, 64, 0.80, -10, 24, 0.1 },
+};
+} // anonymous namespace
+
+QImage CompositeShadowParams::alpha(qreal dpr, ScratchArena *arena) const
+{
+    return BoxShadowHelper::compositeShadowAlpha(
+        box(),
+        layers,
+        dpr,
+        BoxShadowHelper::Algorithm::Separable,
+        arena);
+}
+
+CompositeShadowParams elevationShadowParams(int elevation)
+{
+    const ElevationLevel *level = nullptr;
+    for (const ElevationLevel &candidate : s_elevationLevels) {
+        if (candidate.elevation > elevation) {
+            break;
+        }
+        level = &candidate;
+    }
+
+    if (!level) {
+        return CompositeShadowParams();
+    }
+
+    return CompositeShadowParams(
+        QPoint(0, level->offset),
+        {
+            // The "shape" shadow.
+            ShadowLayer(QPoint(0, 0), level->shapeRadius, level->shapeOpacity),
+            // The "contrast" shadow.
+            ShadowLayer(QPoint(0, level->contrastOffset), level->contrastRadius, level->contrastOpacity),
+        }
+    );
+}
+
+QVector<int> elevationLevels()
+{
+    QVector<int> elevations;
+    for (const ElevationLevel &level : s_elevationLevels) {
+        elevations.append(level.elevation);
+    }
+    return elevations;
+}
+
+} // namespace Material
@@ -0,0 +1,102 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// own
+#include "BoxShadowHelper.h"
+
+// Qt
+#include <QImage>
+#include <QPoint>
+#include <QRect>
+#include <QVector>
+
+namespace Material
+{
+
+class ScratchArena;
+
+struct CompositeShadowParams
+{
+    CompositeShadowParams() = default;
+
+    CompositeShadowParams(
+            const QPoint &offset,
+            const QVector<BoxShadowHelper::ShadowLayer> &layers)
+        : offset(offset)
+        , layers(layers) {}
+
+    int radius() const
+    {
+        int radius = 0;
+        for (const BoxShadowHelper::ShadowLayer &layer : layers) {
+            radius = qMax(radius, layer.radius);
+        }
+        return radius;
+    }
+
+    // In order to properly render a box shadow with a given radius, the box
+    // size should be at least twice the radius. The box is placed so that
+    // the shadow image starts at the origin.
+    QRect box() const
+    {
+        const int shadowSize = radius();
+        return QRect(shadowSize, shadowSize, 2 * shadowSize + 1, 2 * shadowSize + 1);
+    }
+
+    // The whole shadow image, the box with the shadow radius on every side.
+    QRect rect() const
+    {
+        const int shadowSize = radius();
+        return box().adjusted(-shadowSize, -shadowSize, shadowSize, shadowSize);
+    }
+
+    // Combines all layers into one alpha plane that covers
+    // BoxShadowHelper::compositeShadowRect() of the box.
+    QImage alpha(qreal dpr, ScratchArena *arena = nullptr) const;
+
+    bool operator==(const CompositeShadowParams &other) const
+    {
+        return offset == other.offset && layers == other.layers;
+    }
+
+    bool operator!=(const CompositeShadowParams &other) const
+    {
+        return !(*this == other);
+    }
+
+    QPoint offset;
+    QVector<BoxShadowHelper::ShadowLayer> layers;
+};
+
+// Returns the shadow of a surface that is raised by the given Material
+// elevation, in dp. Elevations between the levels of the table get the
+// shadow of the level below, and there is no shadow at 0dp.
+CompositeShadowParams elevationShadowParams(int elevation);
+
+// Elevations of all levels of the table, in dp. Every other elevation gets
+// the shadow of one of them, so these are the only shadows there are.
+QVector<int> elevationLevels();
+
+// Elevations of active and inactive normal windows, in dp. Every session
+// needs their shadows first, so their alpha planes are baked into the
+// plugin at build time. Shadows of other levels are generated on demand.
+const int DEFAULT_ACTIVE_ELEVATION = 24;
+const int DEFAULT_INACTIVE_ELEVATION = 12;
+
+} // namespace Material
@@ -17,19 +17,40 @@
 
 // own
 #include "Decoration.h"
+#include "BakedShadow.h"
 #include "BoxShadowHelper.h"
 #include "CloseButton.h"
+#include "CompositeShadowParams.h"
+#include "DiskShadowCache.h"
+#include "Logging.h"
 #include "MaximizeButton.h"
 #include "MinimizeButton.h"
+#include "ScratchArena.h"
 
 // KDecoration
 #include <KDecoration2/DecoratedClient>
 #include <KDecoration2/DecorationSettings>
 #include <KDecoration2/DecorationShadow>
 
+// KF
+#include <KWindowInfo>
+
 // Qt
+#include <QCache>
+#include <QDataStream>
+#include <QElapsedTimer>
+#include <QFutureWatcher>
+#include <QHash>
+#include <QPair>
 #include <QPainter>
 #include <QSharedPointer>
+#include <QThreadPool>
+#include <QVector>
+#include <QtConcurrentRun>
+
+// std
+#include <algorithm>
+#include <limits>
 
 namespace Material
 {
@@ -37,54 +58,139 @@ namespace Material
 namespace
 {
 
-struct ShadowParams
+using BoxShadowHelper::ShadowLayer;
+
+QDataStream &operator<<(QDataStream &stream, const ShadowLayer &layer)
 {
-    ShadowParams() = default;
+    return stream << layer.offset << layer.radius << layer.opacity;
+}
 
-    ShadowParams(const QPoint &offset, int radius, qreal opacity)
-        : offset(offset)
-        , radius(radius)
-        , opacity(opacity) {}
+QDataStream &operator<<(QDataStream &stream, const CompositeShadowParams &params)
+{
+    stream << params.offset << params.layers.count();
+    for (const ShadowLayer &layer : params.layers) {
+        stream << layer;
+    }
+    return stream;
+}
 
-    QPoint offset;
-    int radius = 0;
-    qreal opacity = 0;
+// Material elevations in dp of active and inactive windows. Dialogs are
+// raised above normal windows, and utility windows such as toolbars and
+// palettes stay close to the window they belong to.
+struct WindowElevations
+{
+    int active;
+    int inactive;
 };
 
-struct CompositeShadowParams
+const WindowElevations s_normalElevations = { DEFAULT_ACTIVE_ELEVATION, DEFAULT_INACTIVE_ELEVATION };
+const WindowElevations s_dialogElevations = { 24, 16 };
+const WindowElevations s_utilityElevations = { 8, 4 };
+
+WindowElevations windowElevations(const KDecoration2::DecoratedClient *client)
 {
-    CompositeShadowParams() = default;
+    // Clients on Wayland have no window type, but modal ones are dialogs.
+    if (client->isModal()) {
+        return s_dialogElevations;
+    }
+    if (!client->windowId()) {
+        return s_normalElevations;
+    }
+
+    const KWindowInfo info(client->windowId(), NET::WMWindowType);
+    const NET::WindowTypes types = NET::NormalMask | NET::DialogMask | NET::UtilityMask
+        | NET::ToolbarMask | NET::MenuMask | NET::SplashMask;
+
+    switch (info.windowType(types)) {
+    case NET::Dialog:
+        return s_dialogElevations;
+    case NET::Utility:
+    case NET::Toolbar:
+    case NET::Menu:
+    case NET::Splash:
+        return s_utilityElevations;
+    default:
+        return s_normalElevations;
+    }
+}
 
-    CompositeShadowParams(
-            const QPoint &offset,
-            const ShadowParams &shadow1,
-            const ShadowParams &shadow2)
-        : offset(offset)
-        , shadow1(shadow1)
-        , shadow2(shadow2) {}
+// Shadows of small windows are scaled down, so they don't get a shadow
+// that is larger than the window itself. The class of a window is picked
+// by its smaller side, and scales its elevation by a fraction.
+struct ShadowSizeClass
+{
+    int maxSize;
+    int numerator;
+    int denominator;
+};
 
-    QPoint offset;
-    ShadowParams shadow1;
-    ShadowParams shadow2;
+const ShadowSizeClass s_shadowSizeClasses[] = {
+    { 200, 1, 3 },
+    { 500, 2, 3 },
+    { std::numeric_limits<int>::max(), 1, 1 },
 };
 
-const CompositeShadowParams s_shadowParams = CompositeShadowParams(
-    QPoint(0, 18),
-    ShadowParams(QPoint(0, 0), 64, 0.8),
-    ShadowParams(QPoint(0, -10), 24, 0.1)
-);
+const int SHADOW_SIZE_CLASS_COUNT = sizeof(s_shadowSizeClasses) / sizeof(s_shadowSizeClasses[0]);
+
+// A window only moves to another class once it is this far past the
+// threshold, so resizing it around the threshold doesn't make the shadow
+// flip back and forth.
+const int SHADOW_SIZE_CLASS_HYSTERESIS = 32;
+
+int initialShadowSizeClass(int size)
+{
+    int sizeClass = 0;
+    while (size >= s_shadowSizeClasses[sizeClass].maxSize) {
+        ++sizeClass;
+    }
+    return sizeClass;
+}
+
+int nextShadowSizeClass(int size, int sizeClass)
+{
+    while (sizeClass > 0
+            && size < s_shadowSizeClasses[sizeClass - 1].maxSize - SHADOW_SIZE_CLASS_HYSTERESIS) {
+        --sizeClass;
+    }
+    while (sizeClass < SHADOW_SIZE_CLASS_COUNT - 1
+            && size >= s_shadowSizeClasses[sizeClass].maxSize + SHADOW_SIZE_CLASS_HYSTERESIS) {
+        ++sizeClass;
+    }
+    return sizeClass;
+}
 
 } // anonymous namespace
 
 static int s_decoCount = 0;
 static QColor s_shadowColor(33, 33, 33);
-static QSharedPointer<KDecoration2::DecorationShadow> s_cachedShadow;
+
+// Blurring is the expensive part of a shadow, so the alpha masks are
+// cached per elevation, and tinted on demand. Masks of the default
+// elevations are baked into the plugin and only wrapped; any other mask is
+// loaded or generated when a window needs it. Tinted shadows are kept for
+// the few elevations and colors in use at the same time.
+static QHash<QByteArray, QImage> s_shadowAlphas;
+using TintedShadowKey = QPair<QByteArray, QRgb>;
+static QCache<TintedShadowKey, QSharedPointer<KDecoration2::DecorationShadow>> s_tintedShadows(16);
+// Temporary buffers for generating shadows. Every elevation in use needs
+// its own shadow, so the memory is kept between them.
+static ScratchArena s_shadowScratchArena;
+
+// Alpha masks that are neither cached nor baked are loaded or generated
+// on a worker thread. Jobs run one at a time, so they are the only users
+// of the scratch arena. There is at most one job per mask.
+using ShadowAlphaWatcher = QFutureWatcher<QImage>;
+Q_GLOBAL_STATIC(QThreadPool, s_shadowThreadPool)
+static QHash<QByteArray, ShadowAlphaWatcher *> s_pendingShadowAlphas;
 
 static qreal s_titleBarOpacityActive = 0.9;
 static qreal s_titleBarOpacityInactive = 1.0;
 
 Decoration::Decoration(QObject *parent, const QVariantList &args)
     : KDecoration2::Decoration(parent, args)
+    , m_activeElevation(0)
+    , m_inactiveElevation(0)
+    , m_shadowSizeClass(SHADOW_SIZE_CLASS_COUNT - 1)
 {
     ++s_decoCount;
 }
@@ -92,7 +198,18 @@ Decoration::Decoration(QObject *parent, const QVariantList &args)
 Decoration::~Decoration()
 {
     if (--s_decoCount == 0) {
-        s_cachedShadow.clear();
+        // A job may still be using the scratch arena.
+        if (s_shadowThreadPool.exists()) {
+            s_shadowThreadPool->waitForDone();
+        }
+        // Finished jobs would put their masks back into the cache from
+        // the event loop, after it has been cleared. Deleting the watchers
+        // disconnects them and drops their pending notifications.
+        qDeleteAll(s_pendingShadowAlphas);
+        s_pendingShadowAlphas.clear();
+        s_shadowAlphas.clear();
+        s_tintedShadows.clear();
+        s_shadowScratchArena.release();
     }
 }
 
@@ -129,6 +246,21 @@ void Decoration::init()
     connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
             this, repaintTitleBar);
 
+    // Active windows are raised above inactive ones.
+    const WindowElevations elevations = windowElevations(decoratedClient);
+    m_activeElevation = elevations.active;
+    m_inactiveElevation = elevations.inactive;
+
+    connect(decoratedClient, &KDecoration2::DecoratedClient::activeChanged,
+            this, &Decoration::updateShadow);
+
+    m_shadowSizeClass = initialShadowSizeClass(qMin(decoratedClient->width(), decoratedClient->height()));
+
+    connect(decoratedClient, &KDecoration2::DecoratedClient::widthChanged,
+            this, &Decoration::updateShadowSizeClass);
+    connect(decoratedClient, &KDecoration2::DecoratedClient::heightChanged,
+            this, &Decoration::updateShadowSizeClass);
+
     updateBorders();
     updateResizeBorders();
     updateTitleBar();
@@ -165,8 +297,9 @@ void Decoration::init()
     updateButtonsGeometry();
 
     // For some reason, the shadow should be installed the last. Otherwise,
-    // the Window Decorations KCM crashes.
-    updateShadow();
+    // the Window Decorations KCM crashes. A shadow that is not ready yet is
+    // installed from the event loop, which is after init() has returned.
+    updateShadows();
 }
 
 void Decoration::updateBorders()
@@ -210,68 +343,208 @@ void Decoration::updateButtonsGeometry()
     update();
 }
 
-void Decoration::updateShadow()
+static QByteArray shadowAlphaCacheKey(const CompositeShadowParams &params)
 {
-    if (!s_cachedShadow.isNull()) {
-        setShadow(s_cachedShadow);
-        return;
-    }
+    QByteArray key;
+    QDataStream stream(&key, QIODevice::WriteOnly);
+    stream.setVersion(QDataStream::Qt_5_0);
+    stream << params;
+    return key;
+}
 
-    auto withOpacity = [] (const QColor &color, qreal opacity) -> QColor {
-        QColor c(color);
-        c.setAlphaF(opacity);
-        return c;
-    };
+static void clearRect(QImage &image, const QRect &rect)
+{
+    const QRect clipped = rect & image.rect();
+    for (int y = clipped.top(); y <= clipped.bottom(); ++y) {
+        QRgb *line = reinterpret_cast<QRgb *>(image.scanLine(y));
+        std::fill_n(line + clipped.left(), clipped.width(), 0);
+    }
+}
 
-    // In order to properly render a box shadow with a given radius `shadowSize`,
-    // the box size should be at least `2 * QSize(shadowSize, shadowSize)`.
-    const int shadowSize = qMax(s_shadowParams.shadow1.radius, s_shadowParams.shadow2.radius);
-    const QRect box(shadowSize, shadowSize, 2 * shadowSize + 1, 2 * shadowSize + 1);
-    const QRect rect = box.adjusted(-shadowSize, -shadowSize, shadowSize, shadowSize);
+// Tints the combined alpha plane of all layers and turns it into a shadow.
+//
+// KWin takes the sizes of the nine-patch tiles from the pixel size of the
+// texture and uses them as logical sizes next to the padding, so the
+// shadow is always rendered at a scale of 1. A texture with more pixels
+// would make the tiles larger on screen instead of sharper, which is why
+// shadows are upscaled on HiDPI outputs and there is no cache per device
+// pixel ratio.
+static QSharedPointer<KDecoration2::DecorationShadow> createShadow(const CompositeShadowParams &params,
+                                                                   const QImage &alpha, const QColor &color)
+{
+    const int shadowSize = params.radius();
+    const QRect box = params.box();
+    const QRect rect = params.rect();
+    const QRect compositeRect = BoxShadowHelper::compositeShadowRect(box, params.layers);
 
     QImage shadow(rect.size(), QImage::Format_ARGB32_Premultiplied);
     shadow.fill(Qt::transparent);
 
-    QPainter painter(&shadow);
-    painter.setRenderHint(QPainter::Antialiasing);
-
-    // Draw the "shape" shadow.
-    BoxShadowHelper::boxShadow(
-        &painter,
-        box,
-        s_shadowParams.shadow1.offset,
-        s_shadowParams.shadow1.radius,
-        withOpacity(s_shadowColor, s_shadowParams.shadow1.opacity));
-
-    // Draw the "contrast" shadow.
-    BoxShadowHelper::boxShadow(
-        &painter,
-        box,
-        s_shadowParams.shadow2.offset,
-        s_shadowParams.shadow2.radius,
-        withOpacity(s_shadowColor, s_shadowParams.shadow2.opacity));
+    BoxShadowHelper::tintAlpha(
+        shadow,
+        compositeRect.topLeft() - rect.topLeft(),
+        alpha,
+        color,
+        BoxShadowHelper::TintMode::Source);
 
     // Mask out inner rect.
     const QMargins padding = QMargins(
-        shadowSize - s_shadowParams.offset.x(),
-        shadowSize - s_shadowParams.offset.y(),
-        shadowSize + s_shadowParams.offset.x(),
-        shadowSize + s_shadowParams.offset.y());
+        shadowSize - params.offset.x(),
+        shadowSize - params.offset.y(),
+        shadowSize + params.offset.x(),
+        shadowSize + params.offset.y());
     const QRect innerRect = rect - padding;
 
-    painter.setPen(Qt::NoPen);
-    painter.setBrush(Qt::black);
-    painter.setCompositionMode(QPainter::CompositionMode_DestinationOut);
-    painter.drawRect(innerRect);
+    clearRect(shadow, innerRect.translated(-rect.topLeft()));
+
+    // The texture is already a minimal nine-patch: only the center column
+    // and row are stretched, and every other column and row differs from
+    // them because the falloff of the blur spans the whole corner tiles.
+    // Dropping pixels would change how the shadow looks.
+    auto decorationShadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
+    decorationShadow->setPadding(padding);
+    decorationShadow->setInnerShadowRect(QRect(shadow.rect().center(), QSize(1, 1)));
+    decorationShadow->setShadow(shadow);
 
-    painter.end();
+    return decorationShadow;
+}
 
-    s_cachedShadow = QSharedPointer<KDecoration2::DecorationShadow>::create();
-    s_cachedShadow->setPadding(padding);
-    s_cachedShadow->setInnerShadowRect(QRect(shadow.rect().center(), QSize(1, 1)));
-    s_cachedShadow->setShadow(shadow);
+// Runs on the worker thread.
+static QImage loadOrCreateShadowAlpha(const CompositeShadowParams &params, const QByteArray &cacheKey)
+{
+    QElapsedTimer timer;
+    timer.start();
+
+    QImage alpha = DiskShadowCache::load(cacheKey);
+    if (!alpha.isNull()) {
+        qCDebug(MATERIAL_SHADOW, "Loaded shadow alpha (radius %d) from disk in %.3f ms",
+                params.radius(), timer.nsecsElapsed() / 1e6);
+        return alpha;
+    }
 
-    setShadow(s_cachedShadow);
+    // The mask outlives the scratch memory it was generated in.
+    alpha = params.alpha(1.0, &s_shadowScratchArena).copy();
+    s_shadowScratchArena.reset();
+    qCDebug(MATERIAL_SHADOW, "Created shadow alpha (radius %d) in %.3f ms",
+            params.radius(), timer.nsecsElapsed() / 1e6);
+    DiskShadowCache::store(cacheKey, alpha);
+
+    return alpha;
+}
+
+// Returns the job that loads or generates the alpha mask, and starts it
+// if there is none yet.
+static ShadowAlphaWatcher *pendingShadowAlpha(const CompositeShadowParams &params)
+{
+    const QByteArray cacheKey = shadowAlphaCacheKey(params);
+
+    ShadowAlphaWatcher *watcher = s_pendingShadowAlphas.value(cacheKey);
+    if (watcher) {
+        return watcher;
+    }
+
+    watcher = new ShadowAlphaWatcher();
+
+    // This is connected before any decoration waits for the job, so the
+    // mask is already cached when they look it up.
+    QObject::connect(watcher, &ShadowAlphaWatcher::finished, watcher, [watcher, cacheKey] {
+        s_shadowAlphas.insert(cacheKey, watcher->result());
+        s_pendingShadowAlphas.remove(cacheKey);
+        watcher->deleteLater();
+    });
+
+    s_shadowThreadPool->setMaxThreadCount(1);
+    watcher->setFuture(QtConcurrent::run(s_shadowThreadPool(), loadOrCreateShadowAlpha, params, cacheKey));
+    s_pendingShadowAlphas.insert(cacheKey, watcher);
+
+    return watcher;
+}
+
+// Returns the shadow in the given color, or a null pointer if its alpha
+// mask is not ready yet.
+static QSharedPointer<KDecoration2::DecorationShadow> tintedShadow(const CompositeShadowParams &params,
+                                                                   const QColor &color)
+{
+    const QByteArray alphaKey = shadowAlphaCacheKey(params);
+    const TintedShadowKey key(alphaKey, color.rgba());
+    if (const QSharedPointer<KDecoration2::DecorationShadow> *shadow = s_tintedShadows.object(key)) {
+        return *shadow;
+    }
+
+    // Shadows of the default elevations are baked, so they never need a job.
+    QImage alpha = s_shadowAlphas.value(alphaKey);
+    if (alpha.isNull()) {
+        alpha = BakedShadow::alpha(params);
+        if (alpha.isNull()) {
+            return {};
+        }
+        s_shadowAlphas.insert(alphaKey, alpha);
+    }
+
+    QElapsedTimer timer;
+    timer.start();
+
+    const QSharedPointer<KDecoration2::DecorationShadow> shadow = createShadow(params, alpha, color);
+    s_tintedShadows.insert(key, new QSharedPointer<KDecoration2::DecorationShadow>(shadow));
+
+    qCDebug(MATERIAL_SHADOW, "Tinted shadow (radius %d) in %.3f ms",
+            params.radius(), timer.nsecsElapsed() / 1e6);
+
+    return shadow;
+}
+
+void Decoration::updateShadow()
+{
+    // Both variants are already resolved, so focus changes do no image work.
+    setShadow(client().data()->isActive() ? m_activeShadow : m_inactiveShadow);
+}
+
+void Decoration::updateShadows()
+{
+    // A variant whose job is not done yet keeps its previous shadow, and
+    // both are looked up again when the job is done.
+    auto resolve = [this] (int elevation, QSharedPointer<KDecoration2::DecorationShadow> &variant) {
+        const CompositeShadowParams params = elevationShadowParams(elevation);
+        if (params.layers.isEmpty()) {
+            variant.clear();
+            return;
+        }
+
+        const QSharedPointer<KDecoration2::DecorationShadow> shadow = tintedShadow(params, s_shadowColor);
+        if (shadow.isNull()) {
+            connect(pendingShadowAlpha(params), &ShadowAlphaWatcher::finished,
+                    this, &Decoration::updateShadows, Qt::UniqueConnection);
+            return;
+        }
+
+        variant = shadow;
+    };
+
+    resolve(elevation(true), m_activeShadow);
+    resolve(elevation(false), m_inactiveShadow);
+
+    updateShadow();
+}
+
+void Decoration::updateShadowSizeClass()
+{
+    const auto *decoratedClient = client().data();
+    const int size = qMin(decoratedClient->width(), decoratedClient->height());
+
+    const int sizeClass = nextShadowSizeClass(size, m_shadowSizeClass);
+    if (sizeClass == m_shadowSizeClass) {
+        return;
+    }
+
+    m_shadowSizeClass = sizeClass;
+    updateShadows();
+}
+
+int Decoration::elevation(bool active) const
+{
+    const int elevation = active ? m_activeElevation : m_inactiveElevation;
+    const ShadowSizeClass &sizeClass = s_shadowSizeClasses[m_shadowSizeClass];
+    return elevation * sizeClass.numerator / sizeClass.denominator;
 }
 
 int Decoration::titleBarHeight() const
@@ -22,6 +22,7 @@
 #include <KDecoration2/DecorationButtonGroup>
 
 // Qt
+#include <QSharedPointer>
 #include <QVariant>
 
 namespace Material
@@ -50,8 +51,11 @@ private:
     void updateTitleBar();
     void updateButtonsGeometry();
     void updateShadow();
+    void updateShadows();
+    void updateShadowSizeClass();
 
     int titleBarHeight() const;
+    int elevation(bool active) const;
 
     QColor titleBarBackgroundColor() const;
     QColor titleBarForegroundColor() const;
@@ -64,6 +68,18 @@ private:
     KDecoration2::DecorationButtonGroup *m_leftButtons;
     KDecoration2::DecorationButtonGroup *m_rightButtons;
 
+    // Material elevations of the window in dp. They depend on the type of
+    // the window.
+    int m_activeElevation;
+    int m_inactiveElevation;
+
+    // Index of the size class of the window, it scales the elevation.
+    int m_shadowSizeClass;
+
+    // Shared with other decorations, swapped when the window is focused.
+    QSharedPointer<KDecoration2::DecorationShadow> m_activeShadow;
+    QSharedPointer<KDecoration2::DecorationShadow> m_inactiveShadow;
+
     friend class CloseButton;
     friend class MaximizeButton;
     friend class MinimizeButton;
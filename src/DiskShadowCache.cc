@@ -0,0 +1,183 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "DiskShadowCache.h"
+
+// Qt
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QSaveFile>
+#include <QStandardPaths>
+
+// std
+#include <cstring>
+#include <memory>
+
+namespace Material
+{
+namespace DiskShadowCache
+{
+
+namespace
+{
+const quint32 MAGIC = 0x4d445348; // "MDSH"
+
+// Bump the version whenever the way shadows are generated changes,
+// so stale entries are not picked up.
+const quint32 VERSION = 5;
+
+struct Header
+{
+    quint32 magic;
+    quint32 version;
+    qint32 width;
+    qint32 height;
+    qint32 bytesPerLine;
+    double devicePixelRatio;
+};
+} // anonymous namespace
+
+static QString cacheDirectory()
+{
+    return QStandardPaths::writableLocation(QStandardPaths::GenericCacheLocation)
+        + QStringLiteral("/material-decoration/shadows");
+}
+
+// Entries of other versions can never be loaded again, so they are removed
+// whenever a new entry is stored.
+static void removeStaleEntries(const QDir &directory)
+{
+    const QStringList fileNames = directory.entryList({ QStringLiteral("*.shadow") }, QDir::Files);
+    for (const QString &fileName : fileNames) {
+        QFile file(directory.filePath(fileName));
+        if (!file.open(QIODevice::ReadOnly)) {
+            continue;
+        }
+
+        quint32 prefix[2] = {};
+        const bool valid = file.read(reinterpret_cast<char *>(prefix), sizeof(prefix)) == sizeof(prefix)
+            && prefix[0] == MAGIC && prefix[1] == VERSION;
+        file.close();
+
+        if (!valid) {
+            file.remove();
+        }
+    }
+}
+
+static QString cacheFilePath(const QByteArray &key)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(reinterpret_cast<const char *>(&VERSION), sizeof(VERSION));
+    hash.addData(key);
+
+    return cacheDirectory() + QLatin1Char('/')
+        + QString::fromLatin1(hash.result().toHex()) + QStringLiteral(".shadow");
+}
+
+QImage load(const QByteArray &key)
+{
+    std::unique_ptr<QFile> file(new QFile(cacheFilePath(key)));
+    if (!file->open(QIODevice::ReadOnly)) {
+        return {};
+    }
+
+    const qint64 fileSize = file->size();
+    if (fileSize < static_cast<qint64>(sizeof(Header))) {
+        return {};
+    }
+
+    // The file stays open as long as the image refers to the mapped pixels.
+    // The mapping is read-only, so the image has to detach before it is
+    // written to.
+    const uchar *data = file->map(0, fileSize);
+    if (!data) {
+        return {};
+    }
+
+    Header header;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.magic != MAGIC || header.version != VERSION) {
+        return {};
+    }
+
+    if (header.width <= 0 || header.height <= 0
+        || header.bytesPerLine < header.width
+        || fileSize != static_cast<qint64>(sizeof(Header)) + qint64(header.bytesPerLine) * header.height) {
+        return {};
+    }
+
+    auto cleanup = [](void *info) {
+        delete static_cast<QFile *>(info);
+    };
+
+    QImage image(data + sizeof(Header), header.width, header.height, header.bytesPerLine,
+                 QImage::Format_Alpha8, cleanup, file.release());
+    image.setDevicePixelRatio(header.devicePixelRatio);
+
+    return image;
+}
+
+void store(const QByteArray &key, const QImage &alpha)
+{
+    const QImage image = alpha.convertToFormat(QImage::Format_Alpha8);
+    if (image.isNull()) {
+        return;
+    }
+
+    const QDir directory(cacheDirectory());
+    if (!directory.mkpath(QStringLiteral("."))) {
+        return;
+    }
+
+    removeStaleEntries(directory);
+
+    Header header;
+    std::memset(&header, 0, sizeof(header));
+    header.magic = MAGIC;
+    header.version = VERSION;
+    header.width = image.width();
+    header.height = image.height();
+    header.bytesPerLine = image.bytesPerLine();
+    header.devicePixelRatio = image.devicePixelRatio();
+
+    // Write to a temporary file first so concurrent readers never
+    // see a partially written entry.
+    QSaveFile file(cacheFilePath(key));
+    if (!file.open(QIODevice::WriteOnly)) {
+        return;
+    }
+
+    // Rows keep the stride of the image so the mapped pixels stay aligned,
+    // but the padding at the end of rows is not initialized.
+    const QByteArray padding(image.bytesPerLine() - image.width(), 0);
+
+    file.write(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (int y = 0; y < image.height(); ++y) {
+        file.write(reinterpret_cast<const char *>(image.constScanLine(y)), image.width());
+        file.write(padding);
+    }
+
+    file.commit();
+}
+
+} // namespace DiskShadowCache
+} // namespace Material
@@ -0,0 +1,39 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Qt
+#include <QByteArray>
+#include <QImage>
+
+namespace Material
+{
+namespace DiskShadowCache
+{
+
+// Loads a previously stored alpha mask of a shadow. The pixels are
+// memory-mapped rather than read. Returns a null image if there is no
+// valid entry for the key.
+QImage load(const QByteArray &key);
+
+// Stores the alpha mask so next processes can skip generating it. Masks
+// are stored before they are tinted, so one entry serves every color.
+void store(const QByteArray &key, const QImage &alpha);
+
+} // namespace DiskShadowCache
+} // namespace Material
@@ -0,0 +1,119 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "ScratchArena.h"
+
+// Qt
+#include <QMutexLocker>
+
+// std
+#include <algorithm>
+#include <cstdint>
+
+namespace Material
+{
+
+namespace
+{
+const std::size_t ALIGNMENT = 64;
+
+// The arena gives memory back once it has been more than this many times
+// larger than the high-water mark of every recent generation.
+const std::size_t SHRINK_FACTOR = 2;
+
+inline std::size_t alignSize(std::size_t size)
+{
+    return (size + ALIGNMENT - 1) & ~(ALIGNMENT - 1);
+}
+} // anonymous namespace
+
+ScratchArena::Block::Block(std::size_t size)
+    : storage(new char[size + ALIGNMENT - 1])
+    , size(size)
+{
+    const std::uintptr_t address = reinterpret_cast<std::uintptr_t>(storage.get());
+    data = storage.get() + (alignSize(address) - address);
+}
+
+ScratchArena::ScratchArena()
+{
+}
+
+ScratchArena::~ScratchArena()
+{
+}
+
+void *ScratchArena::allocate(std::size_t size)
+{
+    size = alignSize(qMax<std::size_t>(size, 1));
+
+    QMutexLocker locker(&m_mutex);
+
+    if (m_blocks.empty() || m_offset + size > m_blocks.back().size) {
+        const std::size_t blockSize = m_blocks.empty() ? size : qMax(size, 2 * m_blocks.back().size);
+        m_blocks.emplace_back(blockSize);
+        m_offset = 0;
+    }
+
+    void *data = m_blocks.back().data + m_offset;
+    m_offset += size;
+    m_used += size;
+
+    return data;
+}
+
+void ScratchArena::reset()
+{
+    m_highWaterMarks[m_resetCount % m_highWaterMarks.size()] = m_used;
+    ++m_resetCount;
+
+    const std::size_t highWaterMark = *std::max_element(m_highWaterMarks.begin(), m_highWaterMarks.end());
+    const bool isFragmented = m_blocks.size() > 1;
+    const bool isOversized = m_resetCount >= int(m_highWaterMarks.size())
+        && capacity() > SHRINK_FACTOR * highWaterMark;
+
+    if (isFragmented || isOversized) {
+        m_blocks.clear();
+        if (highWaterMark) {
+            m_blocks.emplace_back(highWaterMark);
+        }
+    }
+
+    m_offset = 0;
+    m_used = 0;
+}
+
+void ScratchArena::release()
+{
+    m_blocks.clear();
+    m_highWaterMarks.fill(0);
+    m_resetCount = 0;
+    m_offset = 0;
+    m_used = 0;
+}
+
+std::size_t ScratchArena::capacity() const
+{
+    std::size_t capacity = 0;
+    for (const Block &block : m_blocks) {
+        capacity += block.size;
+    }
+    return capacity;
+}
+
+} // namespace Material
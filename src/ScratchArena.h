@@ -0,0 +1,82 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Qt
+#include <QMutex>
+
+// std
+#include <array>
+#include <cstddef>
+#include <memory>
+#include <vector>
+
+namespace Material
+{
+
+// Memory for temporary buffers that is reused across shadow generations.
+// Allocations are carved out of large blocks and stay valid until reset().
+// On reset, the blocks are merged into one that fits the high-water mark
+// of recent generations, and it is shrunk once it has been much larger
+// than needed for a while.
+class ScratchArena
+{
+public:
+    ScratchArena();
+    ~ScratchArena();
+
+    // Returns uninitialized memory aligned to a cache line. It is safe to
+    // call this from several threads at once.
+    void *allocate(std::size_t size);
+
+    template <typename T>
+    T *allocate(int count)
+    {
+        return static_cast<T *>(allocate(count * sizeof(T)));
+    }
+
+    // Makes all memory available again. Nothing that was allocated from
+    // the arena may be used afterwards.
+    void reset();
+
+    // Frees all memory.
+    void release();
+
+    std::size_t capacity() const;
+
+private:
+    struct Block
+    {
+        explicit Block(std::size_t size);
+
+        std::unique_ptr<char[]> storage;
+        char *data;
+        std::size_t size;
+    };
+
+    std::vector<Block> m_blocks;
+    std::size_t m_offset = 0;
+    std::size_t m_used = 0;
+    std::array<std::size_t, 8> m_highWaterMarks = {};
+    int m_resetCount = 0;
+    QMutex m_mutex;
+
+    Q_DISABLE_COPY(ScratchArena)
+};
+
+} // namespace Material
@@ -0,0 +1,70 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// own
+#include "ShadowReference.h"
+
+// Qt
+#include <QRect>
+
+// std
+#include <cmath>
+
+namespace Material
+{
+namespace ShadowReference
+{
+
+QVector<qreal> gaussianStepProfile(int size, int start, int length, qreal sigma)
+{
+    QVector<qreal> profile(size);
+    for (int x = 0; x < size; ++x) {
+        if (sigma <= 0) {
+            profile[x] = (x >= start && x < start + length) ? 1 : 0;
+            continue;
+        }
+        // Difference of two Gaussian CDFs.
+        const qreal scale = 1.0 / (sigma * std::sqrt(2.0));
+        const qreal center = x + 0.5;
+        profile[x] = 0.5 * (std::erf((center - start) * scale) - std::erf((center - start - length) * scale));
+    }
+    return profile;
+}
+
+QImage gaussianShadowAlpha(const QSize &boxSize, int radius, qreal dpr)
+{
+    const QSize size = boxSize + 2 * QSize(radius, radius);
+    const QRect boxRect = QRect(QPoint(radius, radius) * dpr, boxSize * dpr);
+    const qreal sigma = 0.5 * qRound(radius * dpr);
+
+    QImage shadow(size * dpr, QImage::Format_Alpha8);
+
+    const QVector<qreal> horizontal = gaussianStepProfile(shadow.width(), boxRect.x(), boxRect.width(), sigma);
+    const QVector<qreal> vertical = gaussianStepProfile(shadow.height(), boxRect.y(), boxRect.height(), sigma);
+
+    for (int y = 0; y < shadow.height(); ++y) {
+        uchar *line = shadow.scanLine(y);
+        for (int x = 0; x < shadow.width(); ++x) {
+            line[x] = qRound(255 * horizontal[x] * vertical[y]);
+        }
+    }
+
+    return shadow;
+}
+
+} // namespace ShadowReference
+} // namespace Material
@@ -0,0 +1,43 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+#pragma once
+
+// Qt
+#include <QImage>
+#include <QSize>
+#include <QVector>
+
+namespace Material
+{
+namespace ShadowReference
+{
+
+// Exact shadows to measure the generated ones against. They are slow, and
+// only used by the tests and the tools.
+
+// A step of the given length convolved with a Gaussian, sampled at the
+// pixel centers. Without a standard deviation, it is the step itself.
+QVector<qreal> gaussianStepProfile(int size, int start, int length, qreal sigma);
+
+// Alpha plane of the box laid out like boxShadowAlpha() does, blurred with
+// an exact Gaussian with the standard deviation from the CSS spec, which
+// is half of the radius in device pixels.
+QImage gaussianShadowAlpha(const QSize &boxSize, int radius, qreal dpr);
+
+} // namespace ShadowReference
+} // namespace Material
@@ -0,0 +1,101 @@
+/*
+ * Copyright (C) 2018 Vlad Zagorodniy <vladzzag@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program. If not, see <http://www.gnu.org/licenses/>.
+ */
+
+// Generates the source file with the alpha planes of the default elevations,
+// see BakedShadow.h. It runs at build time with the same shadow code as
+// the plugin, so the baked planes are identical to generated ones.
+
+// own
+#include "CompositeShadowParams.h"
+
+// Qt
+#include <QSaveFile>
+#include <QString>
+#include <QTextStream>
+
+// std
+#include <cstdio>
+
+using namespace Material;
+
+static void writeAlpha(QTextStream &stream, const QString &name, const QImage &alpha)
+{
+    stream << "alignas(4) static const uchar " << name << "[] = {\n";
+    for (int y = 0; y < alpha.height(); ++y) {
+        const uchar *line = alpha.constScanLine(y);
+        for (int x = 0; x < alpha.bytesPerLine(); ++x) {
+            // Padding at the end of lines is not initialized.
+            const int value = x < alpha.width() ? line[x] : 0;
+            stream << (x % 16 == 0 ? "    " : " ") << value << ",";
+            if (x % 16 == 15 || x == alpha.bytesPerLine() - 1) {
+                stream << "\n";
+            }
+        }
+    }
+    stream << "};\n\n";
+}
+
+int main(int argc, char **argv)
+{
+    if (argc != 2) {
+        std::fprintf(stderr, "Usage: %s <output>\n", argv[0]);
+        return 1;
+    }
+
+    QSaveFile file(QString::fromLocal8Bit(argv[1]));
+    if (!file.open(QIODevice::WriteOnly)) {
+        std::fprintf(stderr, "Could not open %s\n", argv[1]);
+        return 1;
+    }
+
+    QTextStream stream(&file);
+    stream << "// Generated by bakeshadow, do not edit.\n\n"
+           << "// own\n"
+           << "#include \"BakedShadow.h\"\n\n"
+           << "namespace Material\n{\nnamespace BakedShadow\n{\n\n";
+
+    // Shadows are always rendered at a scale of 1, see Decoration.cc.
+    const QVector<int> elevations = { DEFAULT_ACTIVE_ELEVATION, DEFAULT_INACTIVE_ELEVATION };
+    QVector<QImage> planes;
+    for (const int elevation : elevations) {
+        const QImage alpha = elevationShadowParams(elevation).alpha(1.0);
+        writeAlpha(stream, QStringLiteral("s_alpha%1").arg(planes.count()), alpha);
+        planes.append(alpha);
+    }
+
+    stream << "const Entry entries[] = {\n";
+    for (int i = 0; i < planes.count(); ++i) {
+        const QImage &alpha = planes.at(i);
+        stream << "    { " << elevations.at(i)
+               << ", " << alpha.width()
+               << ", " << alpha.height()
+               << ", " << alpha.bytesPerLine()
+               << ", s_alpha" << i << " },\n";
+    }
+    stream << "};\n\n"
+           << "const int entryCount = " << planes.count() << ";\n\n"
+           << "} // namespace BakedShadow\n"
+           << "} // namespace Material\n";
+
+    stream.flush();
+    if (!file.commit()) {
+        std::fprintf(stderr, "Could not write %s\n", argv[1]);
+        return 1;
+    }
+
+    return 0;
+}